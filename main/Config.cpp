@@ -18,6 +18,19 @@ static const char* TAG = "config";
 
 extern Nvs nvs;
 
+// esp-<last 3 bytes of the MAC address>
+static std::string defaultMqttId() {
+    uint8_t mac[8];
+    int rc = esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    if (rc != ESP_OK) {
+        ESP_LOGE(TAG, "esp_read_mac: %s", esp_err_to_name(rc));
+        std::fill_n(mac, sizeof(mac), 0);
+    }
+    char buf[16];
+    sprintf(buf, "esp-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    return buf;
+}
+
 bool Config::Read() {
     ESP_LOGI(TAG, "Reading config");
     if (!nvs.StartRead()) {
@@ -33,24 +46,32 @@ bool Config::Read() {
     mqttClientKey = nvs.ReadString("mqttck");
     mqttClientCert = nvs.ReadString("mqttcc");
     mqttqos = nvs.ReadShort("mqttqos");
+    mqtt_legacy_topics = nvs.ReadShort("mqttlegacy", 1);
+    mqtt_protocol = nvs.ReadShort("mqttproto", 3);
     rftKey = nvs.ReadInt("rftKey");
     high_hum_threshold = normalize_high_hum_threshold(nvs.ReadShort("hum1"));
+    keyframe_interval = nvs.ReadShort("keyframe");
+    deadbands = nvs.ReadString("deadband");
+    poll_min = nvs.ReadShort("pollmin", default_poll_min);
+    poll_max = nvs.ReadShort("pollmax", default_poll_max);
+    history_series = nvs.ReadString("histser");
+    telemetry_batch = nvs.ReadShort("telebatch");
+    normalize_poll();
     for (int i = 0; i < sensors.size(); i++) {
         sensors[i].type = nvs.ReadShort(("sens_typ" + std::to_string(i)).c_str());
         sensors[i].sda = nvs.ReadShort(("sens_sda" + std::to_string(i)).c_str());
         sensors[i].scl = nvs.ReadShort(("sens_scl" + std::to_string(i)).c_str());
     }
     nvs.EndRead();
-    if (mqttId.empty()) {
-        uint8_t mac[8];
-        int rc = esp_read_mac(mac, ESP_MAC_WIFI_STA);
-        if (rc != ESP_OK) {
-            ESP_LOGE(TAG, "esp_read_mac: %s", esp_err_to_name(rc));
-            std::fill_n(mac, sizeof(mac), 0);
-        }
-        char buf[16];
-        sprintf(buf, "esp-%02x%02x%02x", mac[3], mac[4], mac[5]);
-        mqttId = buf;
+    if (mqttId.empty())
+        mqttId = defaultMqttId();
+    // the client id is also the device namespace, itho/<id>/, where it has to be a valid topic level
+    mqttTopicId = mqttId;
+    if (!mqtt_valid_topic_id(mqttTopicId.c_str())) {
+        mqttTopicId = defaultMqttId();
+        if (!mqtt_legacy_topics)
+            ESP_LOGE(TAG, "MQTT client id '%s' can't be used in topics (empty, contains / + # or longer than %d), using itho/%s/",
+                     mqttId.c_str(), (int)MQTT_MAX_TOPIC_ID, mqttTopicId.c_str());
     }
     mqtt_config.credentials.client_id = mqttId.c_str();
     mqtt_config.broker.address.uri = mqtturi.c_str();
@@ -59,6 +80,15 @@ bool Config::Read() {
     mqtt_config.credentials.authentication.certificate = trimToNull(mqttClientCert.c_str());
     mqtt_config.pub_qos = mqttqos;
     mqtt_config.sub_qos = mqttqos;
+    mqtt_config.topic_id = mqttTopicId.c_str();
+    mqtt_config.legacy_topics = mqtt_legacy_topics;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    mqtt_config.mqtt5 = mqtt_protocol == 5;
+#else
+    if (mqtt_protocol == 5)
+        ESP_LOGW(TAG, "MQTT 5 is not enabled in this build (CONFIG_MQTT_PROTOCOL_5), using 3.1.1");
+#endif
+    mqtt_config.session.protocol_ver = mqtt_config.mqtt5 ? MQTT_PROTOCOL_V_5 : MQTT_PROTOCOL_V_3_1_1;
     return true;
 }
 
@@ -72,8 +102,16 @@ bool Config::Write() {
     nvs.WriteString("mqttck", mqttClientKey);
     nvs.WriteString("mqttcc", mqttClientCert);
     nvs.WriteShort("mqttqos", mqttqos);
+    nvs.WriteShort("mqttlegacy", mqtt_legacy_topics);
+    nvs.WriteShort("mqttproto", mqtt_protocol);
     nvs.WriteInt("rftKey", rftKey);
     nvs.WriteShort("hum1", high_hum_threshold);
+    nvs.WriteShort("keyframe", keyframe_interval);
+    nvs.WriteString("deadband", deadbands);
+    nvs.WriteShort("pollmin", poll_min);
+    nvs.WriteShort("pollmax", poll_max);
+    nvs.WriteString("histser", history_series);
+    nvs.WriteShort("telebatch", telemetry_batch);
     for (int i = 0; i < sensors.size(); i++) {
         nvs.WriteShort(("sens_typ" + std::to_string(i)).c_str(), sensors[i].type);
         nvs.WriteShort(("sens_sda" + std::to_string(i)).c_str(), sensors[i].sda);
@@ -143,6 +181,9 @@ bool Config::Reconfigure() {
     } else {
         if (!read_string("MQTT Client ID", mqttId))
             return false;
+        if (!mqttId.empty() && !mqtt_valid_topic_id(mqttId.c_str()))
+            ESP_LOGW(TAG, "This client id can't be used in topics, with MQTT legacy topics 0 the namespace will be itho/%s/",
+                     defaultMqttId().c_str());
         if (!read_string("MQTT Server Cert PEM (if needed)", mqttServerCert, true))
             return false;
         if (!read_string("MQTT Client Key PEM (if needed)", mqttClientKey, true))
@@ -153,6 +194,10 @@ bool Config::Reconfigure() {
             return false;
         if (!read_short("MQTT QoS (0,1,2)", mqttqos))
             return false;
+        if (!read_short("MQTT legacy topics (1 = esp/esp-data, 0 = itho/<client id>/...)", mqtt_legacy_topics))
+            return false;
+        if (!read_short("MQTT protocol (3 = 3.1.1, 5 = 5)", mqtt_protocol))
+            return false;
     }
     if (!read_short("high_hum_threshold? (in 0.1%)", high_hum_threshold))
         return false;
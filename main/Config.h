@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include <string>
 
@@ -18,12 +19,21 @@ class Config {
   public:
     std::string mqtturi;
     std::string mqttId;
+    std::string mqttTopicId; // mqttId, or the default id when mqttId is not a valid topic level
     std::string mqttServerCert;
     std::string mqttClientKey;
     std::string mqttClientCert;
     uint32_t rftKey = 0;
     uint16_t mqttqos = 0;
+    uint16_t mqtt_legacy_topics = 1; // 1 = esp, esp-data, esp-data-*; 0 = itho/<mqttId>/*
+    uint16_t mqtt_protocol = 3;      // 3 = MQTT 3.1.1, 5 = MQTT 5
     uint16_t high_hum_threshold = default_high_hum_threshold;
+    uint16_t keyframe_interval = 0; // 0 = publish every status in full, N = in full every N status intervals, changes only in between
+    std::string deadbands;          // delta publishing deadbands, "INDEX:VALUE,..." in units of the field's last digit
+    uint16_t poll_min = default_poll_min; // status poll interval bounds in s
+    uint16_t poll_max = default_poll_max;
+    std::string history_series;   // status value indices recorded in the history, "INDEX,...", empty = default
+    uint16_t telemetry_batch = 0; // status samples per binary telemetry batch on esp-data-bin, 0 = JSON on esp-data
     std::array<SensorConfig, max_sensors> sensors;
 
     bool Read();
@@ -33,6 +43,12 @@ class Config {
 
     static constexpr uint16_t default_high_hum_threshold = 770; // * 0.1 %
     static uint16_t normalize_high_hum_threshold(uint16_t val) { return val > 0 && val <= 1000 ? val : default_high_hum_threshold; }
+    static constexpr uint16_t default_poll_min = 5; // the former fixed interval, with the deadbands at 0 every change resets to it
+    static constexpr uint16_t default_poll_max = 30;
+    void normalize_poll() {
+        poll_min = std::max<uint16_t>(poll_min, 1);
+        poll_max = std::max(poll_max, poll_min);
+    }
     int read_string(const char* msg, std::string& val, bool multiline = false);
     int read_short(const char* msg, uint16_t& val);
 };
@@ -0,0 +1,80 @@
+#include "command.h"
+
+static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+static int hexDigit(char c) {
+    if (isDigit(c))
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Strict: an optional sign and digits only, within int32_t
+static bool parseInt(const char* s, size_t n, int32_t& out) {
+    size_t i = 0;
+    bool neg = n && (s[0] == '-' || s[0] == '+') ? s[i++] == '-' : false;
+    if (i == n)
+        return false;
+    int64_t v = 0;
+    for (; i < n; ++i) {
+        if (!isDigit(s[i]))
+            return false;
+        v = v * 10 + (s[i] - '0');
+        if (v > (int64_t)INT32_MAX + neg)
+            return false;
+    }
+    out = neg ? -v : v;
+    return true;
+}
+
+// Words of two hex digits per byte, bytes may be written together ("8260" = "82 60")
+static bool parseHexWord(const char* s, size_t n, CommandArgs& args) {
+    if (n % 2)
+        return false;
+    for (size_t i = 0; i < n; i += 2) {
+        int hi = hexDigit(s[i]), lo = hexDigit(s[i + 1]);
+        if (hi < 0 || lo < 0 || args.count == COMMAND_MAX_BYTES)
+            return false;
+        args.bytes[args.count++] = hi << 4 | lo;
+    }
+    return true;
+}
+
+bool parseCommandArgs(ArgType type, uint8_t min, uint8_t max, const char* s, size_t n, CommandArgs& args) {
+    while (n && *s == ' ') {
+        ++s;
+        --n;
+    }
+    while (n && s[n - 1] == ' ')
+        --n;
+    args.text = s;
+    args.text_len = n;
+    args.count = 0;
+    for (size_t i = 0; i < n;) {
+        size_t e = i;
+        while (e < n && s[e] != ' ')
+            ++e;
+        switch (type) {
+        case ArgType::NONE:
+            return false;
+        case ArgType::INT:
+            if (args.count == COMMAND_MAX_INTS || !parseInt(s + i, e - i, args.ints[args.count]))
+                return false;
+            ++args.count;
+            break;
+        case ArgType::HEX:
+            if (!parseHexWord(s + i, e - i, args))
+                return false;
+            break;
+        case ArgType::TEXT:
+            ++args.count;
+            break;
+        }
+        for (i = e; i < n && s[i] == ' ';)
+            ++i;
+    }
+    return args.count >= min && args.count <= max;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define COMMAND_MAX_INTS  4
+#define COMMAND_MAX_BYTES 128
+
+// Where a command may be given
+enum : uint8_t { CMD_CONSOLE = 1, CMD_MQTT = 2, CMD_ANY = CMD_CONSOLE | CMD_MQTT };
+
+struct mqtt_response_t;
+
+enum class ArgType : uint8_t {
+    NONE, // no arguments
+    INT,  // decimal integers
+    HEX,  // hex bytes, e.g. "82 60 C1" or "8260C1"
+    TEXT, // parsed by the handler, words are counted
+};
+
+struct CommandArgs {
+    uint8_t source;
+    const mqtt_response_t* response; // MQTT 5 request: where to send the reply, null if there is none; set by the caller
+    size_t count; // integers, bytes or words
+    int32_t ints[COMMAND_MAX_INTS];
+    uint8_t bytes[COMMAND_MAX_BYTES];
+    const char* text; // the arguments without surrounding spaces, not null terminated
+    size_t text_len;
+};
+
+struct Command {
+    const char* name;
+    ArgType type;
+    uint8_t min_args, max_args;
+    uint8_t sources;
+    bool (*handler)(const CommandArgs& args); // false if the command failed
+    const char* help;
+};
+
+enum class CommandResult : uint8_t { OK, FAILED, UNKNOWN, NOT_AVAILABLE, BAD_ARGS };
+
+constexpr size_t commandLength(const char* s) {
+    size_t n = 0;
+    while (s[n])
+        ++n;
+    return n;
+}
+
+// FNV-1a
+constexpr uint32_t commandHash(const char* s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+// Parses the arguments for a command taking min..max of them; false if they do not match
+bool parseCommandArgs(ArgType type, uint8_t min, uint8_t max, const char* s, size_t n, CommandArgs& args);
+
+// Not constexpr: a duplicate name in a constexpr CommandTable fails to compile
+inline void duplicateCommand() {}
+
+/*
+    Command lookup by exact name ("NAME ARGS", the name ends at the first space).
+    The hash table is built at compile time when the table is constexpr; lookup is one hash and usually one compare.
+    Has no ESP-IDF dependencies and does not allocate.
+*/
+template <size_t N>
+class CommandTable {
+  public:
+    constexpr CommandTable(const Command (&commands)[N]) : commands(commands) {
+        for (size_t i = 0; i < N; ++i) {
+            size_t len = commandLength(commands[i].name);
+            size_t s = commandHash(commands[i].name, len) & (SLOTS - 1);
+            for (; slots[s]; s = (s + 1) & (SLOTS - 1)) {
+                if (same(commands[slots[s] - 1].name, commands[i].name, len + 1))
+                    duplicateCommand();
+            }
+            slots[s] = i + 1;
+        }
+    }
+
+    static constexpr size_t size() { return N; }
+    const Command& operator[](size_t i) const { return commands[i]; }
+
+    const Command* find(const char* name, size_t len) const {
+        for (size_t s = commandHash(name, len) & (SLOTS - 1); slots[s]; s = (s + 1) & (SLOTS - 1)) {
+            const Command& c = commands[slots[s] - 1];
+            if (same(c.name, name, len) && !c.name[len])
+                return &c;
+        }
+        return nullptr;
+    }
+
+    // Finds the command, parses its arguments into args and runs it; args.response is passed on as is
+    CommandResult run(const char* line, size_t len, uint8_t source, CommandArgs& args) const {
+        size_t b = 0;
+        while (b < len && line[b] == ' ')
+            ++b;
+        size_t e = b;
+        while (e < len && line[e] != ' ')
+            ++e;
+        const Command* c = find(line + b, e - b);
+        if (!c)
+            return CommandResult::UNKNOWN;
+        if (!(c->sources & source))
+            return CommandResult::NOT_AVAILABLE;
+        args.source = source;
+        if (!parseCommandArgs(c->type, c->min_args, c->max_args, line + e, len - e, args))
+            return CommandResult::BAD_ARGS;
+        return c->handler(args) ? CommandResult::OK : CommandResult::FAILED;
+    }
+
+  private:
+    static constexpr size_t slotCount() {
+        size_t n = 1;
+        while (n < 2 * N)
+            n *= 2;
+        return n;
+    }
+    static constexpr size_t SLOTS = slotCount();
+
+    static constexpr bool same(const char* a, const char* b, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            if (a[i] != b[i])
+                return false;
+        }
+        return true;
+    }
+
+    const Command* commands;
+    uint8_t slots[SLOTS] = {}; // command index + 1, 0 = empty
+};
@@ -0,0 +1,137 @@
+#include "command_batch.h"
+#include <string.h>
+
+static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+static size_t skipSpace(const char* data, size_t i, size_t n) {
+    while (i < n && isSpace(data[i]))
+        ++i;
+    return i;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool CommandBatch::isBatch(const char* data, size_t len) {
+    size_t i = skipSpace(data, 0, len);
+    if (i < len && data[i] == '[')
+        return true;
+    // mosquitto_pub -s/-l end a single command with a newline: two non-empty lines make a batch
+    const char* nl = (const char*)memchr(data + i, '\n', len - i);
+    return nl && skipSpace(data, nl - data, len) < len;
+}
+
+void CommandBatch::trim(const char*& data, size_t& len) {
+    size_t i = skipSpace(data, 0, len);
+    while (len > i && isSpace(data[len - 1]))
+        --len;
+    data += i;
+    len -= i;
+}
+
+bool CommandBatch::add(const char* s, size_t n) {
+    if (count == BATCH_MAX_COMMANDS || used + n + 1 > BATCH_MAX_TEXT)
+        return false;
+    memcpy(text + used, s, n);
+    text[used + n] = 0;
+    offset[count] = used;
+    len[count++] = n;
+    used += n + 1;
+    return true;
+}
+
+bool CommandBatch::parse(const char* data, size_t n) {
+    count = used = 0;
+    size_t i = skipSpace(data, 0, n);
+    return i < n && data[i] == '[' ? parseJson(data + i, n - i) : parseLines(data, n);
+}
+
+bool CommandBatch::parseLines(const char* data, size_t n) {
+    for (size_t i = 0; i < n;) {
+        const char* end = (const char*)memchr(data + i, '\n', n - i);
+        size_t next = end ? end - data : n;
+        size_t b = skipSpace(data, i, next), e = next;
+        while (e > b && isSpace(data[e - 1]))
+            --e;
+        if (e > b && !add(data + b, e - b))
+            return false;
+        i = next + 1;
+    }
+    return true;
+}
+
+// A JSON array of strings; \uXXXX escapes outside of ASCII are rejected, commands are ASCII
+bool CommandBatch::parseJson(const char* data, size_t n) {
+    size_t i = skipSpace(data, 1, n);
+    if (i < n && data[i] == ']')
+        return skipSpace(data, i + 1, n) == n;
+    char s[BATCH_MAX_TEXT];
+    while (i < n && data[i] == '"') {
+        size_t sl = 0;
+        for (++i; i < n && data[i] != '"'; ++i) {
+            char c = data[i];
+            if (c == '\\') {
+                if (++i == n)
+                    return false;
+                switch (data[i]) {
+                case '"':
+                case '\\':
+                case '/':
+                    c = data[i];
+                    break;
+                case 'n':
+                    c = '\n';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                case 'r':
+                    c = '\r';
+                    break;
+                case 'u': {
+                    int v = 0;
+                    for (int k = 0; k < 4; ++k) {
+                        int h = ++i < n ? hexValue(data[i]) : -1;
+                        if (h < 0)
+                            return false;
+                        v = v << 4 | h;
+                    }
+                    if (v == 0 || v > 0x7F)
+                        return false;
+                    c = v;
+                    break;
+                }
+                default:
+                    return false;
+                }
+            }
+            if (sl == sizeof(s))
+                return false;
+            s[sl++] = c;
+        }
+        if (i == n)
+            return false;
+        size_t b = 0;
+        while (b < sl && isSpace(s[b]))
+            ++b;
+        while (sl > b && isSpace(s[sl - 1]))
+            --sl;
+        if (sl > b && !add(s + b, sl - b))
+            return false;
+        i = skipSpace(data, i + 1, n);
+        if (i < n && data[i] == ',')
+            i = skipSpace(data, i + 1, n);
+        else if (i < n && data[i] == ']')
+            return skipSpace(data, i + 1, n) == n;
+        else
+            return false;
+    }
+    return false;
+}
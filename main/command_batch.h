@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define BATCH_MAX_COMMANDS 16
+#define BATCH_MAX_TEXT     512 // total length of the commands
+
+/*
+    A list of commands in one message, either one command per line or a JSON array of strings:
+        device\nstatus\nset2
+        ["device", "status", "set2"]
+    Empty lines and surrounding white space are ignored, a single line is not a batch.
+
+    Has no ESP-IDF dependencies and does not allocate.
+*/
+class CommandBatch {
+  public:
+    // True if the message is a batch rather than a single command
+    static bool isBatch(const char* data, size_t len);
+    // Strips the surrounding white space of a single command
+    static void trim(const char*& data, size_t& len);
+    // Replaces the commands; returns false if the message is malformed or too large
+    bool parse(const char* data, size_t len);
+    size_t size() const { return count; }
+    // Null terminated
+    const char* command(size_t i) const { return text + offset[i]; }
+    size_t length(size_t i) const { return len[i]; }
+
+  private:
+    bool parseLines(const char* data, size_t n);
+    bool parseJson(const char* data, size_t n);
+    bool add(const char* s, size_t n);
+
+    char text[BATCH_MAX_TEXT];
+    uint16_t offset[BATCH_MAX_COMMANDS];
+    uint16_t len[BATCH_MAX_COMMANDS];
+    size_t count = 0;
+    size_t used = 0;
+};
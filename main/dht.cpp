@@ -13,16 +13,44 @@
 #include "dht.h"
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <stdint.h>
 #include <string.h>
-#include <sys/types.h>
 
 DHT::DHT(const char* tg, gpio_num_t pin) : dhtGpio(pin) {
     strncpy(tag, tg, sizeof(tag));
     ESP_LOGI(tag, "Starting DHT on GPIO %d", dhtGpio);
-    gpio_config_t config{BIT64(dhtGpio), GPIO_MODE_INPUT, GPIO_PULLUP_DISABLE, GPIO_PULLDOWN_DISABLE, GPIO_INTR_DISABLE};
-    gpio_config(&config);
+    received = xQueueCreate(1, sizeof(rmt_rx_done_event_data_t));
+    rmt_rx_channel_config_t rx_config = {};
+    rx_config.gpio_num = pin;
+    rx_config.clk_src = RMT_CLK_SRC_DEFAULT;
+    rx_config.resolution_hz = 1000000; // 1 tick = 1 us
+    rx_config.mem_block_symbols = DHT_MAX_SYMBOLS;
+    rmt_rx_event_callbacks_t callbacks = {};
+    callbacks.on_recv_done = onReceived;
+    esp_err_t err = rmt_new_rx_channel(&rx_config, &channel);
+    if (err == ESP_OK)
+        err = rmt_rx_register_event_callbacks(channel, &callbacks, received);
+    if (err == ESP_OK)
+        err = rmt_enable(channel);
+    if (err != ESP_OK) {
+        ESP_LOGE(tag, "RMT channel: %s", esp_err_to_name(err));
+        if (channel)
+            rmt_del_channel(channel);
+        channel = nullptr;
+    }
+    // the RMT input stays connected, the task drives the start signal on the same pin
+    gpio_set_level(dhtGpio, 1);
+    gpio_set_direction(dhtGpio, GPIO_MODE_INPUT_OUTPUT_OD);
+}
+
+DHT::~DHT() {
+    if (channel) {
+        rmt_disable(channel);
+        rmt_del_channel(channel);
+    }
+    vQueueDelete(received);
 }
 
 bool DHT::errorHandler(int response) {
@@ -33,6 +61,9 @@ bool DHT::errorHandler(int response) {
     case DHT_CHECKSUM_ERROR:
         ESP_LOGE(tag, "Checksum error");
         break;
+    case DHT_INIT_ERROR:
+        ESP_LOGE(tag, "No RMT channel");
+        break;
     case DHT_OK:
         break;
     default:
@@ -41,17 +72,10 @@ bool DHT::errorHandler(int response) {
     return response == DHT_OK;
 }
 
-inline int DHT::waitForLevel(int usTimeOut, bool state) {
-    int uSec = 0;
-    while (gpio_get_level(dhtGpio) != state) {
-        if (uSec > usTimeOut) {
-            uSec = -1;
-            break;
-        }
-        ++uSec;
-        esp_rom_delay_us(1); // uSec delay
-    }
-    return uSec;
+bool IRAM_ATTR DHT::onReceived(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t* edata, void* arg) {
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR((QueueHandle_t)arg, edata, &woken);
+    return woken == pdTRUE;
 }
 
 /*----------------------------------------------------------------------------
@@ -84,98 +108,58 @@ inline int DHT::waitForLevel(int usTimeOut, bool state) {
        the following high-voltage-level signal's length decide the bit is "1" or "0".
         0: 26~28 us
         1: 70 us
-;----------------------------------------------------------------------------*/
+    5) After the last bit the DHT pulls low for 50 us and releases the bus.
 
-#define MAXdhtData 5 // to complete 40 = 5*8 Bits
+    The RMT channel records every level with its duration (1 us resolution) from the release of the start signal
+    until the line stays unchanged for DHT_IDLE_US, the rx done interrupt hands the symbols to the reading task.
+;----------------------------------------------------------------------------*/
 
 int DHT::readDHT() {
-    int uSec = 0;
-    uint8_t dhtData[MAXdhtData] = {};
-    uint8_t byteInx = 0;
-    uint8_t bitInx = 7;
+    if (!channel)
+        return DHT_INIT_ERROR;
+    xQueueReset(received);
 
-    // == Send start signal to DHT sensor ===========
+    // == Send start signal to DHT sensor, sleeping instead of busy waiting ===========
 
-    gpio_set_direction(dhtGpio, GPIO_MODE_OUTPUT);
-
-    // pull down for 5 ms for a smooth and nice wake up
+    int64_t start = esp_timer_get_time();
     gpio_set_level(dhtGpio, 0);
-    esp_rom_delay_us(5000);
-
-    portENTER_CRITICAL(&mutex);
-    // pull up for 25 us to gently ask for data
+    vTaskDelay(1);
+    int held = esp_timer_get_time() - start;
+    if (held < DHT_START_US) // woken right at the next tick
+        esp_rom_delay_us(DHT_START_US - held);
+
+    rmt_receive_config_t rx_config = {};
+    rx_config.signal_range_min_ns = 1000; // glitch filter
+    rx_config.signal_range_max_ns = DHT_IDLE_US * 1000;
+    esp_err_t err = rmt_receive(channel, symbols, sizeof(symbols), &rx_config);
+    // release the line, the pull-up takes it high and the DHT answers
     gpio_set_level(dhtGpio, 1);
-    esp_rom_delay_us(25);
-
-    gpio_set_direction(dhtGpio, GPIO_MODE_INPUT);
-
-    // == DHT will keep the line low for 80 us and then high for 80us ====
-
-    int uSec1 = waitForLevel(50, 0);
-    if (uSec1 < 0) {
-        portEXIT_CRITICAL(&mutex);
-        return DHT_TIMEOUT_ERROR;
+    if (err != ESP_OK) {
+        ESP_LOGE(tag, "RMT receive: %s", esp_err_to_name(err));
+        return DHT_INIT_ERROR;
     }
 
-    // -- 80us up ------------------------
-
-    int uSec2 = waitForLevel(100, 1);
-    // ESP_LOGD(tag, "Response 2 = %d", uSec2);
-    if (uSec2 < 0) {
-        portEXIT_CRITICAL(&mutex);
-        // ESP_LOGW(tag, "Sensor timeout 2");
+    rmt_rx_done_event_data_t rx;
+    if (xQueueReceive(received, &rx, pdMS_TO_TICKS(DHT_TIMEOUT_MS)) != pdTRUE) {
+        // no edges at all: abort the pending receive
+        rmt_disable(channel);
+        rmt_enable(channel);
         return DHT_TIMEOUT_ERROR;
     }
 
-    // == No errors, read the 40 data bits ================
-
-    for (int k = 0; k < 40; k++) {
-        // -- starts new data transmission with low signal
-        uSec = waitForLevel(100, 0);
-        if (uSec < 0) {
-            portEXIT_CRITICAL(&mutex);
-            ESP_LOGW(tag, "Sensor timeout %d @ %d", 1, k);
-            return DHT_TIMEOUT_ERROR;
-        }
-        // high after 50us
-        uSec = waitForLevel(75, 1);
-        if (uSec < 0) {
-            portEXIT_CRITICAL(&mutex);
-            ESP_LOGW(tag, "Sensor timeout %d @ %d", 2, k);
-            return DHT_TIMEOUT_ERROR;
-        }
-        // data bit after 26..28 us
-        esp_rom_delay_us(40);
-
-        if (gpio_get_level(dhtGpio))
-            dhtData[byteInx] |= (1 << bitInx);
-
-        // index to next byte
-        if (bitInx == 0) {
-            bitInx = 7;
-            ++byteInx;
-        } else {
-            --bitInx;
-        }
+    dht_pulse_t pulses[DHT_MAX_SYMBOLS * 2];
+    size_t len = 0;
+    for (size_t i = 0; i < rx.num_symbols && i < DHT_MAX_SYMBOLS; i++) {
+        pulses[len++] = {(uint16_t)rx.received_symbols[i].duration0, (uint8_t)rx.received_symbols[i].level0};
+        pulses[len++] = {(uint16_t)rx.received_symbols[i].duration1, (uint8_t)rx.received_symbols[i].level1};
     }
-    portEXIT_CRITICAL(&mutex);
-
-    // == get humidity from Data[0] and Data[1] ==========================
-    humidity = (((unsigned)dhtData[0] << 8) | dhtData[1]);
-
-    // == get temp from Data[2] and Data[3]
-    temperature = ((((unsigned)dhtData[2] & 0x7F) << 8) | dhtData[3]);
-
-    if (dhtData[2] & 0x80) // negative temp
-        temperature = -temperature;
-
-    ESP_LOGD(tag, "DHT Response = %d, %d, %02x %02x %02x %02x %02x", uSec1, uSec2, dhtData[0], dhtData[1], dhtData[2], dhtData[3], dhtData[4]);
-
-    // == verify if checksum is ok ===========================================
-    // Checksum is the sum of Data 8 bits masked out 0xFF
-
-    if (dhtData[4] == ((dhtData[0] + dhtData[1] + dhtData[2] + dhtData[3]) & 0xFF))
-        return DHT_OK;
-    else
-        return DHT_CHECKSUM_ERROR;
+    int ret = decoder.decode(pulses, len);
+    const uint8_t* data = decoder.data();
+    ESP_LOGD(tag, "DHT Response = %d, %d symbols, %02x %02x %02x %02x %02x", ret, (int)rx.num_symbols, data[0], data[1], data[2], data[3], data[4]);
+    if (ret == DHT_TIMEOUT_ERROR)
+        return ret;
+
+    humidity = decoder.getHumidity();
+    temperature = decoder.getTemperature();
+    return ret;
 }
@@ -1,13 +1,26 @@
 #pragma once
+#include "dht_decoder.h"
 #include <driver/gpio.h>
+#include <driver/rmt_rx.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 
-#define DHT_OK             0
-#define DHT_CHECKSUM_ERROR -1
-#define DHT_TIMEOUT_ERROR  -2
+#define DHT_INIT_ERROR  -3   // no RMT channel
+#define DHT_START_US    1100 // start signal: low for 1..10 ms
+#define DHT_IDLE_US     200  // line unchanged this long ends the capture
+#define DHT_TIMEOUT_MS  20   // whole transfer takes ~5 ms
+#define DHT_MAX_SYMBOLS 64   // one RMT memory block, a read is 43 symbols
+
+/*
+    The start signal is driven on the open drain pin while the task sleeps, then the RMT peripheral captures
+    the sensor's pulse train into memory and DhtDecoder decodes it. Interrupts stay enabled during the whole read.
+    Uses one RMT RX channel per sensor.
+*/
 class DHT {
   public:
     DHT(const char* tag, gpio_num_t pin);
+    DHT(const DHT&) = delete;
+    ~DHT();
     bool errorHandler(int response);
     int readDHT();
     int getHumidity() const { return humidity; }
@@ -15,9 +28,12 @@ class DHT {
 
   private:
     char tag[12];
-    portMUX_TYPE mutex = portMUX_INITIALIZER_UNLOCKED;
     gpio_num_t dhtGpio;
+    rmt_channel_handle_t channel = nullptr;
+    QueueHandle_t received = nullptr;
+    rmt_symbol_word_t symbols[DHT_MAX_SYMBOLS];
+    DhtDecoder decoder;
     int humidity = 0;
     int temperature = 0;
-    int waitForLevel(int usTimeOut, bool state);
+    static bool onReceived(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t* edata, void* arg);
 };
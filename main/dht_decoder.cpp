@@ -0,0 +1,62 @@
+#include "dht_decoder.h"
+
+// accepted pulse lengths in us, generous around the datasheet values to allow for sensor clock drift
+#define RESPONSE_MIN 50 // 80 us low, 80 us high
+#define RESPONSE_MAX 120
+#define BIT_LOW_MIN  20 // 50 us
+#define BIT_LOW_MAX  100
+#define BIT_HIGH_MIN 10 // 26..28 us = 0, 70 us = 1
+#define BIT_HIGH_MAX 100
+#define BIT_ONE      48
+
+int DhtDecoder::decode(const dht_pulse_t* pulses, size_t len) {
+    size_t i = 0;
+    uint8_t level = 0;
+    uint32_t us = 0;
+    auto next = [&]() {
+        while (i < len && !pulses[i].us)
+            ++i;
+        if (i == len)
+            return false;
+        level = pulses[i].level ? 1 : 0;
+        us = pulses[i++].us;
+        for (; i < len && (!pulses[i].us || (pulses[i].level ? 1 : 0) == level); i++)
+            us += pulses[i].us;
+        return true;
+    };
+
+    // skip the end of the start signal up to the response
+    uint32_t low = 0;
+    for (;;) {
+        if (!next())
+            return DHT_TIMEOUT_ERROR;
+        if (!level)
+            low = us;
+        else if (low >= RESPONSE_MIN && low <= RESPONSE_MAX && us >= RESPONSE_MIN && us <= RESPONSE_MAX)
+            break;
+    }
+
+    uint8_t data[5] = {};
+    for (int k = 0; k < 40; k++) {
+        if (!next() || level || us < BIT_LOW_MIN || us > BIT_LOW_MAX)
+            return DHT_TIMEOUT_ERROR;
+        if (!next() || us < BIT_HIGH_MIN || us > BIT_HIGH_MAX)
+            return DHT_TIMEOUT_ERROR;
+        if (us > BIT_ONE)
+            data[k / 8] |= 0x80 >> (k % 8);
+    }
+    for (int k = 0; k < 5; k++)
+        bytes[k] = data[k];
+
+    // Checksum is the sum of Data 8 bits masked out 0xFF
+    if (bytes[4] != ((bytes[0] + bytes[1] + bytes[2] + bytes[3]) & 0xFF))
+        return DHT_CHECKSUM_ERROR;
+    return DHT_OK;
+}
+
+int DhtDecoder::getHumidity() const { return ((unsigned)bytes[0] << 8) | bytes[1]; }
+
+int DhtDecoder::getTemperature() const {
+    int temperature = (((unsigned)bytes[2] & 0x7F) << 8) | bytes[3];
+    return bytes[2] & 0x80 ? -temperature : temperature; // negative temp
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define DHT_OK             0
+#define DHT_CHECKSUM_ERROR -1
+#define DHT_TIMEOUT_ERROR  -2
+
+// A level of the data line and how long it lasted
+struct dht_pulse_t {
+    uint16_t us;
+    uint8_t level;
+};
+
+/*
+    DHT22 (AM2302) decoder working on the level durations captured during a read (e.g. RMT symbols).
+    Looks for the sensor's 80 us low / 80 us high response and measures the high time of the 40 data bits
+    following it: every bit starts with 50 us low, then 26..28 us high is a 0 and 70 us high is a 1.
+    Has no ESP-IDF dependencies, so recorded traces can be decoded on any host.
+*/
+class DhtDecoder {
+  public:
+    /* decodes a capture; adjacent pulses of the same level are merged, zero-length ones ignored */
+    int decode(const dht_pulse_t* pulses, size_t len);
+    const uint8_t* data() const { return bytes; }
+    int getHumidity() const;    // 0.1 %RH
+    int getTemperature() const; // 0.1 C
+
+  private:
+    uint8_t bytes[5] = {};
+};
@@ -0,0 +1,80 @@
+#include "history.h"
+#include <algorithm>
+
+History::History() {
+    tiers[TIER_5S].ring = ring5s;
+    tiers[TIER_5S].cap = HISTORY_5S_LEN;
+    tiers[TIER_1M].ring = ring1m;
+    tiers[TIER_1M].cap = HISTORY_1M_LEN;
+    tiers[TIER_1H].ring = ring1h;
+    tiers[TIER_1H].cap = HISTORY_1H_LEN;
+    reset(0);
+}
+
+void History::reset(size_t series) {
+    nseries = series < HISTORY_MAX_SERIES ? series : HISTORY_MAX_SERIES;
+    for (auto& tier : tiers) {
+        tier.head = tier.count = tier.closed = 0;
+        tier.open = false;
+    }
+}
+
+void History::close(tier_t& tier) {
+    entry_t& e = tier.ring[tier.head];
+    e.t = tier.t;
+    for (size_t i = 0; i < nseries; ++i) {
+        e.min[i] = tier.min[i];
+        e.max[i] = tier.max[i];
+        e.avg[i] = tier.sum[i] / (int64_t)tier.n;
+    }
+    tier.head = (tier.head + 1) % tier.cap;
+    if (tier.count < tier.cap)
+        ++tier.count;
+    ++tier.closed;
+    tier.open = false;
+}
+
+void History::add(uint32_t t, const int64_t* values) {
+    for (int k = 0; k < TIERS; ++k) {
+        tier_t& tier = tiers[k];
+        uint32_t bucket = t - t % period(k);
+        if (tier.open && bucket != tier.t)
+            close(tier);
+        if (!tier.open) {
+            tier.open = true;
+            tier.t = bucket;
+            tier.n = 0;
+            for (size_t i = 0; i < nseries; ++i) {
+                tier.min[i] = tier.max[i] = values[i];
+                tier.sum[i] = 0;
+            }
+        }
+        ++tier.n;
+        for (size_t i = 0; i < nseries; ++i) {
+            if (values[i] < tier.min[i])
+                tier.min[i] = values[i];
+            if (values[i] > tier.max[i])
+                tier.max[i] = values[i];
+            tier.sum[i] += values[i];
+        }
+    }
+}
+
+size_t History::read(int k, uint32_t from, uint32_t to, size_t& cursor, entry_t* out, size_t max) const {
+    const tier_t& tier = tiers[k];
+    // positions closed - count .. closed - 1 are in the ring, position p at (head + cap - (closed - p)) % cap
+    if (cursor > tier.closed) // reset() since the last call
+        cursor = tier.closed;
+    cursor = std::max(cursor, tier.closed - tier.count);
+    size_t n = 0;
+    for (; cursor < tier.closed && n < max; ++cursor) {
+        const entry_t& e = tier.ring[(tier.head + tier.cap - (tier.closed - cursor)) % tier.cap];
+        if (e.t > to) {
+            cursor = tier.closed;
+            break;
+        }
+        if (e.t >= from)
+            out[n++] = e;
+    }
+    return n;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define HISTORY_MAX_SERIES 6
+#define HISTORY_5S_LEN     120 // 10 min
+#define HISTORY_1M_LEN     120 // 2 h
+#define HISTORY_1H_LEN     48  // 2 days
+
+/*
+    Fixed-memory time series store with 5 s, 1 min and 1 h tiers.
+    Every tier aggregates the raw samples into min/max/avg buckets of its own period as they arrive,
+    and keeps the last HISTORY_xx_LEN closed buckets in a ring; the oldest bucket is overwritten.
+    Has no ESP-IDF dependencies and no locking.
+*/
+class History {
+  public:
+    enum { TIER_5S, TIER_1M, TIER_1H, TIERS };
+
+    struct entry_t {
+        uint32_t t; // bucket start, s
+        int64_t min[HISTORY_MAX_SERIES];
+        int64_t max[HISTORY_MAX_SERIES];
+        int64_t avg[HISTORY_MAX_SERIES];
+    };
+
+    History();
+    // Drops all entries and starts recording `series` values per sample
+    void reset(size_t series);
+    size_t series() const { return nseries; }
+    // Adds a sample of series() values taken at time t (s, non-decreasing)
+    void add(uint32_t t, const int64_t* values);
+    /*
+        Copies up to `max` closed buckets of `tier` starting in from..to (inclusive), oldest first; returns the number copied,
+        0 at the end. `cursor` is the position to continue from, 0 to start; it stays valid while buckets are added, so a long
+        export can copy a few buckets per call under a lock and the whole walk is O(n). Buckets overwritten meanwhile are skipped.
+    */
+    size_t read(int tier, uint32_t from, uint32_t to, size_t& cursor, entry_t* out, size_t max) const;
+    size_t count(int tier) const { return tiers[tier].count; }
+    size_t capacity(int tier) const { return tiers[tier].cap; }
+    static uint32_t period(int tier) { return tier == TIER_5S ? 5 : tier == TIER_1M ? 60 : 3600; }
+    static constexpr size_t memory() { return sizeof(History); }
+
+  private:
+    struct tier_t {
+        entry_t* ring;
+        size_t cap, head, count;
+        size_t closed; // buckets closed since reset(), the position of the next one
+        // open bucket
+        bool open;
+        uint32_t t, n;
+        int64_t min[HISTORY_MAX_SERIES], max[HISTORY_MAX_SERIES];
+        int64_t sum[HISTORY_MAX_SERIES];
+    };
+    void close(tier_t& tier);
+
+    size_t nseries = 0;
+    tier_t tiers[TIERS];
+    entry_t ring5s[HISTORY_5S_LEN];
+    entry_t ring1m[HISTORY_1M_LEN];
+    entry_t ring1h[HISTORY_1H_LEN];
+};
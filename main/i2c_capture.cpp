@@ -0,0 +1,117 @@
+#include "i2c_capture.h"
+#include "i2c_decoder.h"
+#include <algorithm>
+
+enum : uint8_t { SCL = I2cDecoder::LINE_SCL, SDA = I2cDecoder::LINE_SDA };
+
+// Calls f(tick, lines) for the SDA edges [i, end) and the SCL edges at `offset` in time order, until it returns false.
+// At the same tick a falling SCL edge comes first and a rising one last: in a frame SDA only changes while SCL is low.
+template <typename F>
+static void walk(const uint32_t* sda, size_t i, size_t end, const uint32_t* scl, size_t nscl, uint32_t offset, F f) {
+    uint8_t lines = SCL | (i % 2 ? 0 : SDA);
+    size_t j = 0;
+    while (i < end || j < nscl) {
+        uint32_t tick;
+        if (j < nscl && (i == end || scl[j] + offset < sda[i] || (scl[j] + offset == sda[i] && j % 2 == 0))) {
+            tick = scl[j++] + offset;
+            lines ^= SCL;
+        } else {
+            tick = sda[i++];
+            lines ^= SDA;
+        }
+        if (!f(tick, lines))
+            return;
+    }
+}
+
+// Protocol errors of the SDA edges [begin, end) with the SCL capture at `offset`, counting stops above `max`
+static size_t count_errors(const uint32_t* sda, size_t begin, size_t end, const uint32_t* scl, size_t nscl, uint32_t offset, size_t max) {
+    size_t errors = 0;
+    bool active = false;
+    uint8_t bits = 0; // SCL clocks since START or the last byte
+    uint8_t prev = SCL | (begin % 2 ? 0 : SDA);
+    walk(sda, begin, end, scl, nscl, offset, [&](uint32_t, uint8_t lines) {
+        uint8_t changed = prev ^ lines;
+        prev = lines;
+        if (changed == SCL) {
+            if (!active)
+                ++errors;
+            else if ((lines & SCL) && ++bits > 9)
+                bits = 1;
+        } else if (lines & SCL) {
+            // SDA changed while SCL is high: a START (falling) or STOP (rising), one clock after a byte or a START without a frame
+            if (active ? bits != 1 : (lines & SDA) != 0)
+                ++errors;
+            active = !(lines & SDA);
+            bits = 0;
+        }
+        return errors <= max;
+    });
+    return errors;
+}
+
+size_t I2cCapture::edges(const uint32_t* symbols, size_t n, uint32_t* out, size_t max) {
+    size_t len = 0;
+    uint32_t t = 0;
+    uint32_t level = 1;
+    for (size_t i = 0; i < n * 2; ++i) {
+        uint32_t half = i % 2 ? symbols[i / 2] >> 16 : symbols[i / 2] & 0xFFFF;
+        uint32_t duration = half & 0x7FFF;
+        if (half >> 15 != level) {
+            if (len == max)
+                break;
+            out[len++] = t;
+            level = half >> 15;
+        }
+        if (!duration) // the level the line stays at
+            break;
+        if (len) // a high level before the first edge is the idle line
+            t += duration;
+    }
+    return len;
+}
+
+size_t I2cCapture::align(const uint32_t* sda, size_t nsda, const uint32_t* scl, size_t nscl, uint32_t lo, uint32_t hi, uint32_t& offset) {
+    offset = lo;
+    if (!nscl)
+        return 0;
+    // every offset is checked against the same SDA edges: from the last one before the window (the START at the lowest offset)
+    // to the first one after the SCL capture at the highest, so edges left out by an offset count as errors
+    size_t begin = std::lower_bound(sda, sda + nsda, lo) - sda;
+    size_t end = std::upper_bound(sda, sda + nsda, hi + scl[nscl - 1]) - sda;
+    begin = begin ? begin - 1 : 0;
+    end = std::min(end + 1, nsda);
+    size_t best = SIZE_MAX, prev = SIZE_MAX;
+    uint32_t run = lo, len = 0; // start of the current run of offsets with the fewest errors, length of the longest
+    for (uint64_t o = lo; o <= hi; ++o) {
+        // most offsets are off by far, stop counting as soon as they are worse
+        size_t e = count_errors(sda, begin, end, scl, nscl, o, best);
+        if (e < best) {
+            best = e;
+            len = 0;
+        }
+        if (e == best) {
+            if (prev != e)
+                run = o;
+            if (o - run + 1 > len) {
+                len = o - run + 1;
+                offset = run + (o - run) / 2;
+            }
+        }
+        prev = e;
+    }
+    return best;
+}
+
+size_t I2cCapture::merge(const uint32_t* sda, size_t nsda, const uint32_t* scl, size_t nscl, uint32_t offset, uint32_t* ticks,
+                         uint8_t* lines, size_t max) {
+    size_t n = 0;
+    walk(sda, 0, nsda, scl, nscl, offset, [&](uint32_t tick, uint8_t l) {
+        if (n == max)
+            return false;
+        ticks[n] = tick;
+        lines[n++] = l;
+        return true;
+    });
+    return n;
+}
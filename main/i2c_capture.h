@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Merges separate captures of SCL and SDA (one RMT RX channel per line) into the edge sequence I2cDecoder takes.
+    A capture is a list of edge times from the line's first edge, which is a falling one as both lines idle high: even indexes
+    are falling edges, odd ones rising.
+
+    Each channel starts at its own first edge, so where an SCL capture lies in the SDA capture is only known roughly (from the
+    times of the rx done interrupts). align() tries every offset of a window and keeps the one making a valid I2C sequence: SCL
+    only clocks between START and STOP, and START/STOP come one SCL clock after a byte. Off by a clock period, data changes fall
+    into SCL high and are seen as START/STOP in the middle of a byte, or SCL clocks before the START. The valid offsets span the
+    data setup/hold slack, align() takes the middle.
+    Has no ESP-IDF dependencies, so captures can be replayed on any host.
+*/
+class I2cCapture {
+  public:
+    /* converts RMT RX symbols (duration0:15 level0:1 duration1:15 level1:1, a zero duration is the level the capture ended at) into
+       edge times from the first falling edge, a high level before it (the idle line) is skipped; returns the number of edges written */
+    static size_t edges(const uint32_t* symbols, size_t n, uint32_t* out, size_t max);
+    /* searches the offset of the SCL capture's first edge in the SDA capture in [lo, hi]; returns the number of protocol errors at
+       that offset, 0 = a valid sequence. A missing STOP at the end is no error (the capture may be truncated), SDA edges of other
+       frames within the window are. */
+    static size_t align(const uint32_t* sda, size_t nsda, const uint32_t* scl, size_t nscl, uint32_t lo, uint32_t hi, uint32_t& offset);
+    /* merges the SDA capture and the SCL capture at `offset` into edges for I2cDecoder: tick (SDA capture time) and line levels
+       after the edge; returns the number of edges written */
+    static size_t merge(const uint32_t* sda, size_t nsda, const uint32_t* scl, size_t nscl, uint32_t offset, uint32_t* ticks,
+                        uint8_t* lines, size_t max);
+};
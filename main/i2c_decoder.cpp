@@ -0,0 +1,60 @@
+#include "i2c_decoder.h"
+
+void I2cDecoder::reset(uint8_t lines) {
+    last = lines & (LINE_SCL | LINE_SDA);
+    active = false; // the time base continues
+    cur = flags = bits = 0;
+}
+
+// SCL=1, SDA 1>0 = Start
+// SCL=1, SDA 0>1 = Stop
+// SCL 0>1, SDA = data
+bool I2cDecoder::feed(uint32_t tick, uint8_t lines, sniffer_event_t& ev) {
+    lines &= LINE_SCL | LINE_SDA;
+    if (started) {
+        rem_ticks += tick - last_tick;
+        now += rem_ticks / ticks_per_us;
+        rem_ticks %= ticks_per_us;
+    }
+    last_tick = tick;
+    started = true;
+    uint8_t prev = last;
+    last = lines;
+    if (prev == lines)
+        return false;
+    if (prev == (LINE_SCL | LINE_SDA) && lines == LINE_SCL) {
+        // (repeated) start; an unterminated frame simply has no STOP event
+        active = true;
+        flags = START;
+        cur = bits = 0;
+        tm_start = tm_byte = now;
+        return false;
+    }
+    if (!active)
+        return false;
+    if (prev == LINE_SCL && lines == (LINE_SCL | LINE_SDA)) {
+        active = false;
+        ev = {now, STOP, (uint16_t)(now - tm_start < 0xFFFF ? now - tm_start : 0xFFFF)};
+        return true;
+    }
+    if (!(prev & LINE_SCL) && (lines & LINE_SCL)) {
+        if (++bits < 9) {
+            cur = (cur << 1) | !!(lines & LINE_SDA);
+            return false;
+        }
+        ev = {now, (uint16_t)(cur | flags | ((lines & LINE_SDA) ? 0 : ACK)), (uint16_t)(now - tm_byte < 0xFFFF ? now - tm_byte : 0xFFFF)};
+        flags = bits = cur = 0;
+        tm_byte = now;
+        return true;
+    }
+    return false;
+}
+
+size_t I2cDecoder::decode(const uint32_t* ticks, const uint8_t* lines, size_t len, sniffer_event_t* out, size_t max) {
+    size_t n = 0;
+    for (size_t i = 0; i < len && n < max; ++i) {
+        if (feed(ticks[i], lines[i], out[n]))
+            ++n;
+    }
+    return n;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Decoded I2C bus event: a data byte with flags, or a STOP
+struct sniffer_event_t {
+    uint32_t tm;   // timestamp in us
+    uint16_t data; // byte | ACK | START, or STOP
+    uint16_t dt;   // us since the previous byte (STOP: since START)
+};
+
+/*
+    I2C bus state machine working on SCL/SDA line samples taken at every edge.
+    Decodes START, data bytes, ACK/NACK and STOP into sniffer events.
+    Has no ESP-IDF dependencies, so it can be fed recorded edge traces on any host.
+
+    Timestamps are free-running tick counters (e.g. CPU cycles) that are allowed to wrap,
+    converted to us using ticks_per_us.
+*/
+class I2cDecoder {
+  public:
+    enum : uint8_t { LINE_SCL = 1, LINE_SDA = 2 };
+    enum : uint16_t { ACK = 0x100, START = 0x200, STOP = 0x400 };
+
+    explicit I2cDecoder(uint32_t ticks_per_us = 1) : ticks_per_us(ticks_per_us ? ticks_per_us : 1) {}
+    /* feeds the line levels (LINE_SCL | LINE_SDA) sampled at `tick`; returns true when `ev` holds a new event */
+    bool feed(uint32_t tick, uint8_t lines, sniffer_event_t& ev);
+    /* decodes a whole trace, returns the number of events written to `out` */
+    size_t decode(const uint32_t* ticks, const uint8_t* lines, size_t len, sniffer_event_t* out, size_t max);
+    /* drops the frame in progress, e.g. after lost edges; `lines` are the current line levels */
+    void reset(uint8_t lines = LINE_SCL | LINE_SDA);
+
+  private:
+    uint32_t ticks_per_us;
+    uint32_t last_tick = 0;
+    uint32_t rem_ticks = 0;
+    uint32_t now = 0; // us
+    uint32_t tm_start = 0;
+    uint32_t tm_byte = 0;
+    uint16_t cur = 0;
+    uint16_t flags = 0;
+    uint8_t bits = 0;
+    uint8_t last = LINE_SCL | LINE_SDA;
+    bool active = false;
+    bool started = false;
+};
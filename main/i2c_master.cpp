@@ -9,6 +9,26 @@
 
 static const char* TAG = "i2c-master";
 
+struct send_request_t {
+    i2c_master_callback_t cb;
+    void* arg;
+    uint32_t len;
+    uint8_t data[I2C_MASTER_MAX_LEN];
+};
+
+static QueueHandle_t send_queue;
+
+static void i2c_master_task(void* arg) {
+    static send_request_t req;
+    while (1) {
+        if (xQueueReceive(send_queue, &req, portMAX_DELAY)) {
+            esp_err_t rc = i2c_master_send((const char*)req.data, req.len);
+            if (req.cb)
+                req.cb(rc, req.arg);
+        }
+    }
+}
+
 void i2c_master_init() {
     i2c_config_t conf {};
     conf.mode = I2C_MODE_MASTER;
@@ -21,20 +41,35 @@ void i2c_master_init() {
     i2c_param_config(I2C_MASTER_NUM, &conf);
     i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0);
     ESP_LOGI(TAG, "Master pin assignment: SCL=%d, SDA=%d", I2C_MASTER_SCL_IO, I2C_MASTER_SDA_IO);
+    send_queue = xQueueCreate(I2C_MASTER_QUEUE_LEN, sizeof(send_request_t));
+    xTaskCreatePinnedToCore(i2c_master_task, "i2c_master", 3072, NULL, 10, NULL, 1);
 }
 
-esp_err_t i2c_master_send(char* buf, uint32_t len) {
+esp_err_t i2c_master_send(const char* buf, uint32_t len) {
+    // the command link lives on the stack and is built once, retries execute it again
+    uint8_t link_buf[I2C_LINK_RECOMMENDED_SIZE(1)];
+    i2c_cmd_handle_t link = i2c_cmd_link_create_static(link_buf, sizeof(link_buf));
+    i2c_master_start(link);
+    i2c_master_write(link, (const uint8_t*)buf, len, true);
+    i2c_master_stop(link);
     esp_err_t rc;
     for (uint32_t i = 0; i < 5; ++i) {
-        i2c_cmd_handle_t link = i2c_cmd_link_create();
-        i2c_master_start(link);
-        i2c_master_write(link, (uint8_t*)buf, len, true);
-        i2c_master_stop(link);
         rc = i2c_master_cmd_begin(I2C_MASTER_NUM, link, 25);
-        i2c_cmd_link_delete(link);
         if (!rc)
             break;
         vTaskDelay(1);
     }
+    i2c_cmd_link_delete_static(link);
     return rc;
 }
+
+esp_err_t i2c_master_send_async(const uint8_t* buf, uint32_t len, i2c_master_callback_t cb, void* arg) {
+    if (len > I2C_MASTER_MAX_LEN)
+        return ESP_ERR_INVALID_SIZE;
+    send_request_t req;
+    req.cb = cb;
+    req.arg = arg;
+    req.len = len;
+    memcpy(req.data, buf, len);
+    return xQueueSend(send_queue, &req, 0) ? ESP_OK : ESP_ERR_NO_MEM;
+}
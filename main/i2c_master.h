@@ -7,6 +7,13 @@
 #define I2C_MASTER_SCL_PULLUP true
 #define I2C_MASTER_NUM        I2C_NUM_0
 #define I2C_MASTER_FREQ_HZ    100000
+#define I2C_MASTER_QUEUE_LEN  8   // pending asynchronous sends
+#define I2C_MASTER_MAX_LEN    128 // longest asynchronous send
+
+// Completion of an asynchronous send, called from the i2c_master task
+typedef void (*i2c_master_callback_t)(esp_err_t rc, void* arg);
 
 void i2c_master_init();
-esp_err_t i2c_master_send(char* buf, uint32_t len);
+esp_err_t i2c_master_send(const char* buf, uint32_t len);
+// Copies buf and queues it for sending; returns ESP_ERR_INVALID_SIZE or ESP_ERR_NO_MEM (queue full) without calling cb
+esp_err_t i2c_master_send_async(const uint8_t* buf, uint32_t len, i2c_master_callback_t cb, void* arg);
@@ -6,30 +6,93 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
+#include <algorithm>
 #include <string.h>
 
 static const char* TAG = "i2c-slave";
 
 static i2c_slave_callback_t i2c_callback;
-static uint8_t buf[I2C_SLAVE_RX_BUF_LEN];
-static size_t buflen;
+static i2c_slave_stats_t stats;
+
+struct slave_frame_t {
+    int64_t start; // time of the first byte, us
+    size_t len;
+    uint8_t data[I2C_SLAVE_FRAME_LEN];
+};
+
+static slave_frame_t frame_pool[I2C_SLAVE_FRAME_POOL];
+static slave_frame_t discard; // receives frames while the pool is exhausted, so the FIFO is still drained
+static QueueHandle_t free_frames;  // slave_frame_t* available for receiving
+static QueueHandle_t ready_frames; // slave_frame_t* waiting for the callback
+
+const uint16_t i2c_slave_latency_bins_ms[I2C_SLAVE_LATENCY_BINS] = {1, 2, 5, 10, 20, 50, 100, 0xFFFF};
+
+// address, reply address, message code (2), flags, payload length
+#define HEADER_LEN 6
 
 static void i2c_slave_task(void* arg) {
     while (1) {
+        // wait for the start of a frame, the pool buffer is only taken once it arrived, so the output task can
+        // return buffers while we wait
+        uint8_t first;
+        if (i2c_slave_read_buffer(I2C_SLAVE_NUM, &first, 1, portMAX_DELAY) <= 0)
+            continue;
+        int64_t start = esp_timer_get_time();
+        slave_frame_t* frame;
+        if (!xQueueReceive(free_frames, &frame, 0)) {
+            frame = &discard;
+            ++stats.pool_exhausted;
+        }
+        frame->start = start;
+        uint8_t* buf = frame->data;
         buf[0] = I2C_SLAVE_ADDRESS << 1;
-        buflen = 1;
-        while (1) {
-            int len1 = i2c_slave_read_buffer(I2C_SLAVE_NUM, buf + buflen, sizeof(buf) - buflen, 10);
-            if (len1 <= 0)
+        buf[1] = first;
+        size_t buflen = 2;
+        // read the header, then exactly the payload + checksum
+        size_t want = HEADER_LEN;
+        while (buflen < want) {
+            int len1 = i2c_slave_read_buffer(I2C_SLAVE_NUM, buf + buflen, want - buflen, I2C_SLAVE_TIMEOUT);
+            if (len1 <= 0) {
+                ++stats.timeouts;
                 break;
+            }
             buflen += len1;
+            if (buflen >= HEADER_LEN)
+                want = std::min(sizeof(frame->data), (size_t)HEADER_LEN + buf[HEADER_LEN - 1] + 1);
         }
-        if (buflen > 1) {
-            i2c_callback(buf, buflen);
+        frame->len = buflen;
+        ++stats.frames;
+        if (frame == &discard)
+            continue;
+        xQueueSend(ready_frames, &frame, 0);
+        uint32_t depth = uxQueueMessagesWaiting(ready_frames);
+        if (depth > stats.queue_max)
+            stats.queue_max = depth;
+    }
+}
+
+// Runs the callback at a lower priority, so a slow broker never delays draining the I2C FIFO
+static void i2c_slave_output_task(void* arg) {
+    while (1) {
+        slave_frame_t* frame;
+        if (xQueueReceive(ready_frames, &frame, portMAX_DELAY)) {
+            uint32_t ms = (esp_timer_get_time() - frame->start) / 1000;
+            int bin = 0;
+            while (bin < I2C_SLAVE_LATENCY_BINS - 1 && ms >= i2c_slave_latency_bins_ms[bin])
+                ++bin;
+            ++stats.latency_hist[bin];
+            i2c_callback(frame->data, frame->len);
+            xQueueSend(free_frames, &frame, 0);
         }
     }
 }
 
+i2c_slave_stats_t i2c_slave_stats() {
+    i2c_slave_stats_t s = stats;
+    s.queue_depth = ready_frames ? uxQueueMessagesWaiting(ready_frames) : 0;
+    return s;
+}
+
 void i2c_slave_init(i2c_slave_callback_t cb) {
     i2c_config_t conf {};
     conf.mode = I2C_MODE_SLAVE;
@@ -44,5 +107,12 @@ void i2c_slave_init(i2c_slave_callback_t cb) {
     i2c_driver_install(I2C_SLAVE_NUM, conf.mode, I2C_SLAVE_RX_BUF_LEN, 0, 0);
     ESP_LOGI(TAG, "Slave pin assignment: SCL=%d, SDA=%d", I2C_SLAVE_SCL_IO, I2C_SLAVE_SDA_IO);
     ESP_LOGI(TAG, "Slave address: %02X (W)", I2C_SLAVE_ADDRESS << 1);
+    free_frames = xQueueCreate(I2C_SLAVE_FRAME_POOL, sizeof(slave_frame_t*));
+    ready_frames = xQueueCreate(I2C_SLAVE_FRAME_POOL, sizeof(slave_frame_t*));
+    for (int i = 0; i < I2C_SLAVE_FRAME_POOL; ++i) {
+        slave_frame_t* f = &frame_pool[i];
+        xQueueSend(free_frames, &f, 0);
+    }
+    xTaskCreatePinnedToCore(i2c_slave_output_task, "i2c_out", 4096, NULL, 5, NULL, 0);
     xTaskCreatePinnedToCore(i2c_slave_task, "i2c_task", 4096, NULL, 22, NULL, 0);
 }
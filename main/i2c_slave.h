@@ -8,7 +8,24 @@
 #define I2C_SLAVE_NUM        I2C_NUM_1
 #define I2C_SLAVE_RX_BUF_LEN 512
 #define I2C_SLAVE_ADDRESS    0x40
+#define I2C_SLAVE_TIMEOUT    10 // ticks without data after which an incomplete frame is dispatched anyway
+#define I2C_SLAVE_LATENCY_BINS 8
+#define I2C_SLAVE_FRAME_POOL 4   // received frames in flight between the receive task and the callback task
+#define I2C_SLAVE_FRAME_LEN  264 // address + 6 byte header + 255 byte payload + checksum
+
+struct i2c_slave_stats_t {
+    uint32_t frames;
+    uint32_t timeouts;       // frames completed by I2C_SLAVE_TIMEOUT instead of their length byte
+    uint32_t pool_exhausted; // frames received while no pool buffer was free, discarded
+    uint32_t queue_depth;    // frames waiting for the callback task
+    uint32_t queue_max;      // high-water mark of queue_depth
+    uint32_t latency_hist[I2C_SLAVE_LATENCY_BINS]; // first byte to callback, bins bounded by i2c_slave_latency_bins_ms
+};
+
+// Upper bounds of the latency histogram bins in ms, the last bin counts everything above
+extern const uint16_t i2c_slave_latency_bins_ms[I2C_SLAVE_LATENCY_BINS];
 
 typedef void (*i2c_slave_callback_t)(const uint8_t* data, size_t len);
 
 void i2c_slave_init(i2c_slave_callback_t cb);
+i2c_slave_stats_t i2c_slave_stats();
@@ -1,4 +1,9 @@
 #include "i2c_sniffer.h"
+#include "i2c_capture.h"
+#include "i2c_decoder.h"
+#include "spsc_ring.h"
+#include "util.h"
+#include <driver/rmt_rx.h>
 #include <soc/gpio_periph.h> // ESP32 GPIO
 #include <esp_log.h>
 #include <esp_system.h>
@@ -6,15 +11,207 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
+#include <algorithm>
 #include <string.h>
 
 static const char* TAG = "i2c-sniffer";
 
-typedef enum { ACK = 0x100, START = 0x200, STOP = 0x400 } state_t;
-typedef uint16_t gpdata_t;
-static QueueHandle_t gpio_evt_queue;
+enum : uint16_t { ACK = I2cDecoder::ACK, START = I2cDecoder::START, STOP = I2cDecoder::STOP };
+
+static TaskHandle_t sniffer_task_handle;
+
+static i2c_sniffer_callback_t sniffer_callback;
+static i2c_sniffer_timing_callback_t timing_callback;
+static sniffer_frame_t frame_pool[I2C_SNIFFER_FRAME_POOL];
+static QueueHandle_t free_frames;  // sniffer_frame_t* available for assembly
+static QueueHandle_t ready_frames; // sniffer_frame_t* waiting for output, nullptr = timing report
+static sniffer_frame_t* frame;     // frame being assembled
+static uint32_t frame_last_tm;     // of the last byte added to it
+static i2c_sniffer_stats_t stats;
+
+// Analyzer state, only touched by sniffer_task
+static uint32_t analyze_period_s;
+static i2c_sniffer_timing_t timing;
+static QueueHandle_t timing_reports; // one i2c_sniffer_timing_t by value, handed to the output task
+static uint32_t timing_stop;
+static bool timing_started, timing_stopped;
+static uint32_t timing_mode; // most frequent bit period bin
+static uint64_t timing_bit_us;
+static uint32_t timing_bits;
+
+// Filter rules are compiled into a per-address action, so most frames are decided on their first byte
+enum : uint8_t { FILTER_PASS = 0, FILTER_DROP = 1, FILTER_CHECK = 2 };
+// Compiled into the table not in use and then switched, so readers (ISR, sniffer task) never see a half written table
+static uint8_t filter_tables[2][256];
+static const uint8_t* volatile filter_action = filter_tables[0];
+static i2c_sniffer_rule_t filter_rules[I2C_SNIFFER_MAX_RULES];
+static size_t filter_rule_count;
+static bool filter_default_drop;
+static portMUX_TYPE filter_mux = portMUX_INITIALIZER_UNLOCKED;
 #define pin_(pin) GPIO_NUM_##pin
 #define PIN(pin)  pin_(pin)
+
+#if I2C_SNIFFER_RMT_CAPTURE
+// A finished RMT capture handed to the sniffer task
+struct sniffer_capture_t {
+    uint8_t line; // SNIFFER_LINE_...
+    uint8_t buffer;
+    uint16_t symbols;
+    uint32_t done_us; // at the rx done interrupt: I2C_SNIFFER_RMT_IDLE_US after the last edge, or at it when the memory is full
+};
+enum : uint8_t { SNIFFER_LINE_SCL, SNIFFER_LINE_SDA };
+// An SDA capture can span a few frames, each with its own SCL capture, so SCL captures wait for the SDA capture they are in
+#define SNIFFER_SCL_BUFFERS 4
+#define SNIFFER_SDA_BUFFERS 2
+#define SNIFFER_RING_SIZE   8 // at least SNIFFER_SCL_BUFFERS + SNIFFER_SDA_BUFFERS, so it never overflows
+#define SNIFFER_SCL_EDGES   (2 * SNIFFER_SCL_BUFFERS * I2C_SNIFFER_RMT_SCL_SYMBOLS)
+#define SNIFFER_SDA_EDGES   (2 * I2C_SNIFFER_RMT_SDA_SYMBOLS)
+static SpscRing<sniffer_capture_t, SNIFFER_RING_SIZE> captures;
+static I2cDecoder decoder(1); // RMT ticks are us
+
+struct sniffer_line_t {
+    rmt_channel_handle_t channel;
+    rmt_symbol_word_t* buffers;
+    uint16_t symbols; // per buffer
+    uint8_t count;
+    uint8_t armed; // buffer being received into
+    uint8_t busy;  // buffers handed to the sniffer task
+    bool receiving;
+};
+static rmt_symbol_word_t scl_buffers[SNIFFER_SCL_BUFFERS][I2C_SNIFFER_RMT_SCL_SYMBOLS];
+static rmt_symbol_word_t sda_buffers[SNIFFER_SDA_BUFFERS][I2C_SNIFFER_RMT_SDA_SYMBOLS];
+static sniffer_line_t sniffer_lines[2] = {{nullptr, scl_buffers[0], I2C_SNIFFER_RMT_SCL_SYMBOLS, SNIFFER_SCL_BUFFERS},
+                                          {nullptr, sda_buffers[0], I2C_SNIFFER_RMT_SDA_SYMBOLS, SNIFFER_SDA_BUFFERS}};
+static rmt_receive_config_t receive_config;
+static bool capture_enabled;
+static portMUX_TYPE capture_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t lost_captures;
+
+// Only touched by sniffer_task
+static sniffer_capture_t scl_pending[SNIFFER_SCL_BUFFERS];
+static size_t scl_pending_count;
+static uint32_t scl_edges[SNIFFER_SCL_EDGES];
+static uint32_t sda_edges[SNIFFER_SDA_EDGES];
+static uint32_t merged_ticks[SNIFFER_SCL_EDGES + SNIFFER_SDA_EDGES];
+static uint8_t merged_lines[SNIFFER_SCL_EDGES + SNIFFER_SDA_EDGES];
+
+// Picks a free buffer for the next capture of the line, with capture_mux held; returns false if it can't receive now
+static inline IRAM_ATTR bool next_buffer(sniffer_line_t& l) {
+    if (!capture_enabled || !l.channel || l.receiving)
+        return false;
+    for (uint8_t i = 1; i <= l.count; ++i) {
+        uint8_t b = (l.armed + i) % l.count;
+        if (!(l.busy & (1 << b))) {
+            l.armed = b;
+            l.receiving = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+// rmt_receive() is in IRAM with CONFIG_RMT_RECV_FUNC_IN_IRAM, so the rx done callback can start the next capture right away
+static IRAM_ATTR void receive(sniffer_line_t& l) {
+    if (rmt_receive(l.channel, l.buffers + l.armed * l.symbols, l.symbols * sizeof(rmt_symbol_word_t), &receive_config) != ESP_OK) {
+        portENTER_CRITICAL_SAFE(&capture_mux);
+        l.receiving = false; // retried by sniffer_task
+        portEXIT_CRITICAL_SAFE(&capture_mux);
+    }
+}
+
+static bool IRAM_ATTR capture_done(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t* edata, void* arg) {
+    uint8_t line = (intptr_t)arg;
+    sniffer_line_t& l = sniffer_lines[line];
+    sniffer_capture_t c = {line, l.armed, (uint16_t)edata->num_symbols, (uint32_t)esp_timer_get_time()};
+    portENTER_CRITICAL_ISR(&capture_mux);
+    l.busy |= 1 << l.armed;
+    l.receiving = false;
+    bool next = next_buffer(l);
+    portEXIT_CRITICAL_ISR(&capture_mux);
+    if (next)
+        receive(l);
+    captures.push(c);
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(sniffer_task_handle, &woken);
+    return woken == pdTRUE;
+}
+
+// Starts receiving on the lines that were just enabled or had no free buffer
+static void arm_lines() {
+    for (auto& l : sniffer_lines) {
+        portENTER_CRITICAL(&capture_mux);
+        bool next = next_buffer(l);
+        portEXIT_CRITICAL(&capture_mux);
+        if (next)
+            receive(l);
+    }
+}
+
+static void release_capture(const sniffer_capture_t& c) {
+    portENTER_CRITICAL(&capture_mux);
+    sniffer_lines[c.line].busy &= ~(1 << c.buffer);
+    portEXIT_CRITICAL(&capture_mux);
+}
+
+static void enable_capture(bool en) {
+    portENTER_CRITICAL(&capture_mux);
+    capture_enabled = en;
+    portEXIT_CRITICAL(&capture_mux);
+    if (en) {
+        arm_lines();
+        return;
+    }
+    for (auto& l : sniffer_lines) {
+        if (!l.channel)
+            continue;
+        // aborts the pending receive
+        rmt_disable(l.channel);
+        rmt_enable(l.channel);
+        portENTER_CRITICAL(&capture_mux);
+        l.receiving = false;
+        portEXIT_CRITICAL(&capture_mux);
+    }
+}
+
+static void init_capture() {
+    receive_config.signal_range_min_ns = 1000; // glitch filter, a level lasts at least 4 us in standard mode
+    receive_config.signal_range_max_ns = I2C_SNIFFER_RMT_IDLE_US * 1000;
+    const gpio_num_t pins[2] = {PIN(I2C_SNIFFER_SCL_PIN), PIN(I2C_SNIFFER_SDA_PIN)};
+    esp_err_t err = ESP_OK;
+    for (int i = 0; i < 2 && err == ESP_OK; ++i) {
+        auto& l = sniffer_lines[i];
+        rmt_rx_channel_config_t rx_config = {};
+        rx_config.gpio_num = pins[i];
+        rx_config.clk_src = RMT_CLK_SRC_DEFAULT;
+        rx_config.resolution_hz = 1000000; // 1 tick = 1 us
+        rx_config.mem_block_symbols = l.symbols;
+        rmt_rx_event_callbacks_t callbacks = {};
+        callbacks.on_recv_done = capture_done;
+        err = rmt_new_rx_channel(&rx_config, &l.channel);
+        if (err == ESP_OK)
+            err = rmt_rx_register_event_callbacks(l.channel, &callbacks, (void*)(intptr_t)i);
+        if (err == ESP_OK)
+            err = rmt_enable(l.channel);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "RMT channel: %s", esp_err_to_name(err));
+        for (auto& l : sniffer_lines) {
+            if (l.channel)
+                rmt_del_channel(l.channel);
+            l.channel = nullptr;
+        }
+    }
+    // frame times in esp_timer us, as with the ISR: the decoder's time base starts at 0
+    sniffer_event_t ev;
+    decoder.feed(0, I2cDecoder::LINE_SCL | I2cDecoder::LINE_SDA, ev);
+}
+
+#else
+
+#define SNIFFER_DRAIN_SIZE 32
+#define SNIFFER_RING_SIZE  512
+static SpscRing<sniffer_event_t, SNIFFER_RING_SIZE> events;
+
 #if I2C_SNIFFER_SCL_PIN < 32 && I2C_SNIFFER_SDA_PIN < 32
 #define SCL     (1 << I2C_SNIFFER_SCL_PIN)
 #define SDA     (1 << I2C_SNIFFER_SDA_PIN)
@@ -27,19 +224,41 @@ static QueueHandle_t gpio_evt_queue;
 #error I2C_SNIFFER_SCL_PIN and I2C_SNIFFER_SDA_PIN must be together < 32 or >= 32
 #endif
 static uint32_t last = SCL | SDA;
+
+static inline IRAM_ATTR uint32_t read_sda_scl_pins() {
+    // gpio_get_level() is not IRAM, i.e. too slow
+    return GPIO_in & (SCL | SDA);
+}
+
+static inline IRAM_ATTR void notify_sniffer_task() {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(sniffer_task_handle, &woken);
+    if (woken)
+        portYIELD_FROM_ISR();
+}
+
 static uint32_t cur;
 static uint32_t bits;
 static uint32_t state;
 static uint32_t tm1, tm2, tm;
+static uint32_t isr_filtered;
 
-static inline IRAM_ATTR void enable_sda_intr(bool en) {
+static inline IRAM_ATTR void push_event(uint32_t data, uint32_t tm, uint32_t dt) {
+    events.push(sniffer_event_t{tm, (uint16_t)data, (uint16_t)(dt < 0xFFFF ? dt : 0xFFFF)});
+}
+
+static inline IRAM_ATTR void enable_intr(bool en) {
     // gpio_set_intr_type() is not IRAM, i.e. too slow
     GPIO.pin[I2C_SNIFFER_SDA_PIN].int_type = en ? GPIO_INTR_ANYEDGE : GPIO_INTR_DISABLE;
 }
 
-static inline IRAM_ATTR uint32_t read_sda_scl_pins() {
-    // gpio_get_level() is not IRAM, i.e. too slow
-    return GPIO_in & (SCL | SDA);
+static void enable_capture(bool en) {
+    enable_intr(en);
+    if (!en) {
+        // the handler enables the interrupt again at the end of a frame in progress
+        vTaskDelay(1);
+        enable_intr(false);
+    }
 }
 
 // SCL=1, SDA 1>0 = Start
@@ -48,7 +267,7 @@ static inline IRAM_ATTR uint32_t read_sda_scl_pins() {
 static void IRAM_ATTR gpio_sda_handler(void* arg) {
     uint32_t st = read_sda_scl_pins();
     if (last == (SCL | SDA) && st == SCL) {
-        enable_sda_intr(false);
+        enable_intr(false);
         state = START;
         cur = bits = 0;
         tm1 = tm2 = esp_timer_get_time();
@@ -57,78 +276,453 @@ static void IRAM_ATTR gpio_sda_handler(void* arg) {
             st = read_sda_scl_pins();
             tm = esp_timer_get_time();
             if (last == SCL && st == (SCL | SDA)) {
-                state = STOP | ((tm - tm1) << 16);
-                xQueueSendFromISR(gpio_evt_queue, &state, NULL);
+                push_event(STOP, tm, tm - tm1);
                 break;
             } else if ((st & SCL) && !(last & SCL)) {
                 if (++bits < 9)
                     cur = (cur << 1) | !!(st & SDA);
                 else {
-                    cur |= state | ((st & SDA) ? 0 : ACK) | ((tm - tm2) << 16);
-                    xQueueSendFromISR(gpio_evt_queue, &cur, NULL);
+                    if (state == START && filter_action[cur] == FILTER_DROP) {
+                        // skip the rest of the frame, no START/STOP is pushed
+                        ++isr_filtered;
+                        break;
+                    }
+                    push_event(cur | state | ((st & SDA) ? 0 : ACK), tm, tm - tm2);
                     state = bits = cur = 0;
                     tm2 = tm;
                 }
             }
         } while (tm - tm1 < 14900);
-        enable_sda_intr(true);
+        enable_intr(true);
+        // wake up the sniffer task once per frame
+        notify_sniffer_task();
     }
     last = st;
 }
 
+#endif
+
+static bool rule_matches(const i2c_sniffer_rule_t& r, const uint8_t* data, size_t len) {
+    if (r.addr >= 0 && (len < 1 || data[0] != r.addr))
+        return false;
+    if (r.code >= 0 && (len < 4 || ((data[2] << 8) | data[3]) != r.code))
+        return false;
+    if (r.flags >= 0 && (len < 5 || data[4] != r.flags))
+        return false;
+    return true;
+}
+
+static bool filter_drops(const uint8_t* data, size_t len) {
+    bool drop = filter_default_drop;
+    portENTER_CRITICAL(&filter_mux);
+    for (size_t i = 0; i < filter_rule_count; ++i) {
+        if (rule_matches(filter_rules[i], data, len)) {
+            drop = filter_rules[i].drop;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&filter_mux);
+    return drop;
+}
+
+static void compile_filter() {
+    portENTER_CRITICAL(&filter_mux);
+    uint8_t* table = filter_tables[filter_action == filter_tables[0]];
+    for (int addr = 0; addr < 256; ++addr) {
+        uint8_t action = filter_default_drop ? FILTER_DROP : FILTER_PASS;
+        for (size_t i = 0; i < filter_rule_count; ++i) {
+            const auto& r = filter_rules[i];
+            if (r.addr < 0 || r.addr == addr) {
+                action = (r.code >= 0 || r.flags >= 0) ? FILTER_CHECK : r.drop ? FILTER_DROP : FILTER_PASS;
+                break;
+            }
+        }
+        table[addr] = action;
+    }
+    filter_action = table;
+    portEXIT_CRITICAL(&filter_mux);
+}
+
+static void drop_frame() {
+    ++stats.filtered;
+    xQueueSend(free_frames, &frame, 0);
+    frame = nullptr;
+}
+
+static void finish_frame(uint8_t status) {
+    if (filter_action[frame->data[0]] == FILTER_CHECK && frame->len < 5 && filter_drops(frame->data, frame->len)) {
+        drop_frame();
+        return;
+    }
+    ++stats.passed;
+    if (status == SNIFFER_FRAME_OK && (frame->len < 2 || checksum(frame->data, frame->len - 1) != frame->data[frame->len - 1]))
+        status = SNIFFER_FRAME_BAD_CHECKSUM;
+    frame->status = status;
+    switch (status) {
+    case SNIFFER_FRAME_OK:
+        ++stats.good;
+        break;
+    case SNIFFER_FRAME_BAD_CHECKSUM:
+        ++stats.bad_checksum;
+        break;
+    default:
+        ++stats.truncated;
+    }
+    xQueueSend(ready_frames, &frame, 0);
+    frame = nullptr;
+}
+
+static void analyze_reset() {
+    timing = {};
+    timing.gap_min_us = UINT32_MAX;
+    timing_started = timing_stopped = false;
+    timing_bit_us = timing_bits = timing_mode = 0;
+}
+
+static void analyze_event(const sniffer_event_t& ev) {
+    timing_started = true;
+    if (ev.data & STOP) {
+        ++timing.frames;
+        timing.busy_us += ev.dt;
+        timing_stop = ev.tm;
+        timing_stopped = true;
+        return;
+    }
+    if ((ev.data & START) && timing_stopped) {
+        uint32_t gap = ev.tm - ev.dt - timing_stop;
+        ++timing.gap_count;
+        timing.gap_total_us += gap;
+        timing.gap_min_us = std::min(timing.gap_min_us, gap);
+        timing.gap_max_us = std::max(timing.gap_max_us, gap);
+        timing_stopped = false;
+    }
+    ++timing.bytes;
+    uint32_t bin = std::min<uint32_t>(ev.dt / 9, I2C_SNIFFER_BIT_HIST - 1);
+    if (++timing.bit_hist[bin] > timing.bit_hist[timing_mode])
+        timing_mode = bin;
+    // a byte is 8 data bits + ACK; anything beyond one extra bit period is clock stretching
+    uint32_t nominal = 9 * (timing_mode + 1);
+    if (ev.dt > nominal + timing_mode + 1) {
+        uint32_t stretch = ev.dt - nominal;
+        ++timing.stretch_count;
+        timing.stretch_total_us += stretch;
+        timing.stretch_max_us = std::max(timing.stretch_max_us, stretch);
+    } else {
+        timing_bit_us += ev.dt;
+        timing_bits += 9;
+    }
+}
+
+static void analyze_report(uint32_t period_us) {
+    timing.period_us = period_us;
+    timing.scl_hz = timing_bit_us ? (uint32_t)(1000000ULL * timing_bits / timing_bit_us) : 0;
+    timing.utilization_pm = timing.period_us ? (uint16_t)std::min<uint64_t>(1000, timing.busy_us * 1000 / timing.period_us) : 0;
+    if (!timing.gap_count)
+        timing.gap_min_us = 0;
+    xQueueOverwrite(timing_reports, &timing);
+    sniffer_frame_t* report = nullptr;
+    xQueueSend(ready_frames, &report, 0);
+    analyze_reset();
+}
+
+// Collects bytes from START to STOP into a frame from the pool
+static void handle_event(const sniffer_event_t& ev) {
+    if (analyze_period_s) {
+        analyze_event(ev);
+        return;
+    }
+    if (ev.data & START) {
+        if (frame)
+            finish_frame(SNIFFER_FRAME_TRUNCATED);
+        if (filter_action[ev.data & 0xFF] == FILTER_DROP) {
+            ++stats.filtered;
+            return;
+        }
+        if (!xQueueReceive(free_frames, &frame, 0)) {
+            ++stats.dropped;
+            return;
+        }
+        frame->tm = ev.tm - ev.dt;
+        frame->len = 0;
+        memset(frame->ack, 0, sizeof(frame->ack));
+    }
+    if (!frame)
+        return;
+    if (ev.data & STOP) {
+        frame->duration = ev.dt;
+        finish_frame(SNIFFER_FRAME_OK);
+        return;
+    }
+    if (frame->len == sizeof(frame->data)) {
+        frame->duration = ev.tm - frame->tm;
+        finish_frame(SNIFFER_FRAME_TRUNCATED);
+        return;
+    }
+    frame_last_tm = ev.tm;
+    if (ev.data & ACK)
+        frame->ack[frame->len / 8] |= 1 << (frame->len % 8);
+    frame->data[frame->len++] = ev.data & 0xFF;
+    if (frame->len == 5 && filter_action[frame->data[0]] == FILTER_CHECK && filter_drops(frame->data, frame->len))
+        drop_frame();
+}
+
+#if I2C_SNIFFER_RMT_CAPTURE
+// us from the first edge of a capture to its rx done interrupt
+static uint32_t capture_length(const sniffer_capture_t& c, const uint32_t* edges, size_t n) {
+    bool full = c.symbols == sniffer_lines[c.line].symbols;
+    return edges[n - 1] + (full ? 0 : I2C_SNIFFER_RMT_IDLE_US);
+}
+
+// Merges an SDA capture with the SCL captures within it and decodes the frames
+static void merge_capture(const sniffer_capture_t& sda) {
+    size_t nsda = I2cCapture::edges(&sniffer_lines[SNIFFER_LINE_SDA].buffers[sda.buffer * I2C_SNIFFER_RMT_SDA_SYMBOLS].val, sda.symbols,
+                                    sda_edges, SNIFFER_SDA_EDGES);
+    if (!nsda)
+        return;
+    uint32_t start = sda.done_us - capture_length(sda, sda_edges, nsda);
+    size_t nscl = 0, kept = 0;
+    for (size_t k = 0; k < scl_pending_count; ++k) {
+        const sniffer_capture_t& c = scl_pending[k];
+        uint32_t* edges = scl_edges + nscl;
+        size_t n = I2cCapture::edges(&sniffer_lines[SNIFFER_LINE_SCL].buffers[c.buffer * I2C_SNIFFER_RMT_SCL_SYMBOLS].val, c.symbols, edges,
+                                     SNIFFER_SCL_EDGES - nscl);
+        int32_t at = n ? (int32_t)(c.done_us - capture_length(c, edges, n) - start) : 0;
+        if (at > (int32_t)(sda_edges[nsda - 1] + I2C_SNIFFER_RMT_ALIGN_US)) {
+            scl_pending[kept++] = c; // in a later SDA capture
+            continue;
+        }
+        release_capture(c);
+        if (at + I2C_SNIFFER_RMT_ALIGN_US < 0) {
+            ++lost_captures; // its SDA capture was lost
+            continue;
+        }
+        n &= ~1; // SCL is high between the captures, one cut off by the memory ends with the last full clock
+        if (!n)
+            continue;
+        uint32_t offset;
+        size_t errors = I2cCapture::align(sda_edges, nsda, edges, n, std::max<int32_t>(at - I2C_SNIFFER_RMT_ALIGN_US, 0),
+                                          at + I2C_SNIFFER_RMT_ALIGN_US, offset);
+        if (errors)
+            ESP_LOGD(TAG, "SCL capture of %u edges at %ld us: %u errors at %lu us", (unsigned)n, (long)at, (unsigned)errors, (unsigned long)offset);
+        for (size_t i = 0; i < n; ++i)
+            edges[i] += offset;
+        nscl += n;
+    }
+    scl_pending_count = kept;
+    size_t n = I2cCapture::merge(sda_edges, nsda, scl_edges, nscl, 0, merged_ticks, merged_lines, sizeof(merged_lines));
+    sniffer_event_t ev;
+    decoder.reset();
+    for (size_t i = 0; i < n; ++i) {
+        if (decoder.feed(start + merged_ticks[i], merged_lines[i], ev))
+            handle_event(ev);
+    }
+    // a frame doesn't continue in the next capture
+    if (frame && !analyze_period_s) {
+        frame->duration = frame_last_tm - frame->tm;
+        finish_frame(SNIFFER_FRAME_TRUNCATED);
+    }
+}
+
+static void drain_ring() {
+    sniffer_capture_t batch[SNIFFER_RING_SIZE];
+    size_t n = captures.pop(batch, SNIFFER_RING_SIZE);
+    for (size_t i = 0; i < n; ++i) {
+        if (batch[i].line == SNIFFER_LINE_SCL) {
+            scl_pending[scl_pending_count++] = batch[i]; // no more captures than buffers
+            continue;
+        }
+        merge_capture(batch[i]);
+        release_capture(batch[i]);
+    }
+    // the SDA capture ends soon after the SCL ones in it, unless it was lost
+    uint32_t now = esp_timer_get_time();
+    size_t kept = 0;
+    for (size_t k = 0; k < scl_pending_count; ++k) {
+        if (now - scl_pending[k].done_us < 1000000) {
+            scl_pending[kept++] = scl_pending[k];
+            continue;
+        }
+        release_capture(scl_pending[k]);
+        ++lost_captures;
+    }
+    scl_pending_count = kept;
+    arm_lines();
+}
+#else
+static void drain_ring() {
+    sniffer_event_t batch[SNIFFER_DRAIN_SIZE];
+    size_t n;
+    while ((n = events.pop(batch, SNIFFER_DRAIN_SIZE)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            handle_event(batch[i]);
+        }
+    }
+}
+#endif
+
+static void sniffer_output_task(void* arg) {
+    sniffer_frame_t* f;
+    for (;;) {
+        if (xQueueReceive(ready_frames, &f, portMAX_DELAY)) {
+            if (!f) {
+                i2c_sniffer_timing_t report;
+                if (xQueueReceive(timing_reports, &report, 0) && timing_callback)
+                    timing_callback(report);
+                continue;
+            }
+            if (sniffer_callback)
+                sniffer_callback(*f);
+            xQueueSend(free_frames, &f, 0);
+        }
+    }
+}
+
 static void sniffer_task(void* arg) {
-    uint32_t x;
-    uint32_t flag = 0;
-    uint32_t tm1 = esp_timer_get_time(), tm;
+    uint32_t overflows = 0;
+    int64_t report_time = esp_timer_get_time();
 
-    gpio_evt_queue = xQueueCreate(256, sizeof(uint32_t));
-    gpio_install_isr_service(ESP_INTR_FLAG_LEVEL3);
+    sniffer_task_handle = xTaskGetCurrentTaskHandle();
     gpio_config_t config = {BIT64(I2C_SNIFFER_SCL_PIN) | BIT64(I2C_SNIFFER_SDA_PIN), GPIO_MODE_INPUT, GPIO_PULLUP_DISABLE, GPIO_PULLDOWN_DISABLE,
                             GPIO_INTR_DISABLE};
     gpio_config(&config);
+#if I2C_SNIFFER_RMT_CAPTURE
+    // the RMT interrupt is allocated on this task's core
+    init_capture();
+#else
+    gpio_install_isr_service(ESP_INTR_FLAG_LEVEL3);
     gpio_isr_handler_add(PIN(I2C_SNIFFER_SDA_PIN), gpio_sda_handler, (void*)I2C_SNIFFER_SDA_PIN);
+#endif
     ESP_LOGI(TAG, "Sniffer pin assignment: SCL=%d, SDA=%d, sniffer %s", I2C_SNIFFER_SCL_PIN, I2C_SNIFFER_SDA_PIN, arg ? "ON" : "OFF");
-    enable_sda_intr(!!arg);
+    enable_capture(!!arg);
 
     for (;;) {
-        if (xQueueReceive(gpio_evt_queue, &x, portMAX_DELAY)) {
-            tm = esp_timer_get_time();
-            if (flag && (tm - tm1) > 200000)
-                printf("\n\n");
-            tm1 = tm;
-            flag = 1;
-            if (x & START) {
-                printf("[");
-            }
-            if (x & STOP) {
-#if I2C_SNIFFER_PRINT_TIMING
-                printf("]/%d\n", (x >> 16));
+        ulTaskNotifyTake(pdTRUE, configTICK_RATE_HZ);
+        drain_ring();
+        int64_t now = esp_timer_get_time();
+        if (!analyze_period_s && timing_started)
+            analyze_reset();
+        if (!timing_started) {
+            report_time = now;
+        } else if (now - report_time >= analyze_period_s * 1000000LL) {
+            analyze_report(now - report_time);
+            report_time = now;
+        }
+        if (i2c_sniffer_overflows() != overflows) {
+            ESP_LOGW(TAG, "Ring full, %lu records dropped", (unsigned long)(i2c_sniffer_overflows() - overflows));
+            overflows = i2c_sniffer_overflows();
+        }
+    }
+}
+
+void i2c_sniffer_init(bool enabled, i2c_sniffer_callback_t cb, i2c_sniffer_timing_callback_t timing_cb) {
+    sniffer_callback = cb;
+    timing_callback = timing_cb;
+    analyze_reset();
+    free_frames = xQueueCreate(I2C_SNIFFER_FRAME_POOL, sizeof(sniffer_frame_t*));
+    ready_frames = xQueueCreate(I2C_SNIFFER_FRAME_POOL + 1, sizeof(sniffer_frame_t*));
+    timing_reports = xQueueCreate(1, sizeof(i2c_sniffer_timing_t));
+    for (int i = 0; i < I2C_SNIFFER_FRAME_POOL; ++i) {
+        sniffer_frame_t* f = &frame_pool[i];
+        xQueueSend(free_frames, &f, 0);
+    }
+    xTaskCreatePinnedToCore(sniffer_output_task, "sniffer_out", 4096, NULL, 5, NULL, I2C_SNIFFER_RUN_ON_CORE);
+    xTaskCreatePinnedToCore(sniffer_task, "sniffer_task", 4096, (void*)enabled, 17, NULL, I2C_SNIFFER_RUN_ON_CORE);
+}
+
+#if I2C_SNIFFER_RMT_CAPTURE
+uint32_t i2c_sniffer_overflows() { return captures.overflows(); }
 #else
-                printf("]\n");
+uint32_t i2c_sniffer_overflows() { return events.overflows(); }
 #endif
-            } else {
-#if I2C_SNIFFER_PRINT_TIMING
-                printf("%02lX/%d%c", (x & 0xFF), (x >> 16), (x & ACK ? '+' : '-'));
+
+i2c_sniffer_stats_t i2c_sniffer_stats() {
+    i2c_sniffer_stats_t res = stats;
+    res.overflows = i2c_sniffer_overflows();
+#if I2C_SNIFFER_RMT_CAPTURE
+    res.lost_captures = lost_captures;
 #else
-                printf("%02lX%c", (x & 0xFF), (x & ACK ? '+' : '-'));
+    res.filtered += isr_filtered;
 #endif
-            }
-        }
+    return res;
+}
+
+void i2c_sniffer_analyze(uint32_t period_s) { analyze_period_s = period_s; }
+
+uint32_t i2c_sniffer_analyze_period() { return analyze_period_s; }
+
+size_t i2c_sniffer_format_timing(const i2c_sniffer_timing_t& t, char* buf, size_t buflen) {
+    int len = snprintf(buf, buflen,
+                       "{\"period_ms\":%lu,\"frames\":%lu,\"bytes\":%lu,\"scl_hz\":%lu,\"utilization\":%u.%u,"
+                       "\"stretch\":{\"count\":%lu,\"max_us\":%lu,\"avg_us\":%lu},"
+                       "\"gap\":{\"count\":%lu,\"min_us\":%lu,\"max_us\":%lu,\"avg_us\":%lu},\"bit_hist\":",
+                       (unsigned long)(t.period_us / 1000), (unsigned long)t.frames, (unsigned long)t.bytes, (unsigned long)t.scl_hz,
+                       t.utilization_pm / 10, t.utilization_pm % 10, (unsigned long)t.stretch_count, (unsigned long)t.stretch_max_us,
+                       (unsigned long)(t.stretch_count ? t.stretch_total_us / t.stretch_count : 0), (unsigned long)t.gap_count,
+                       (unsigned long)t.gap_min_us, (unsigned long)t.gap_max_us, (unsigned long)(t.gap_count ? t.gap_total_us / t.gap_count : 0));
+    for (int i = 0; i < I2C_SNIFFER_BIT_HIST && len > 0 && (size_t)len < buflen; ++i) {
+        len += snprintf(buf + len, buflen - len, "%c%lu", i ? ',' : '[', (unsigned long)t.bit_hist[i]);
     }
+    if (len > 0 && (size_t)len < buflen)
+        len += snprintf(buf + len, buflen - len, "]}");
+    return len < 0 ? 0 : std::min((size_t)len, buflen - 1);
 }
 
-void i2c_sniffer_init(bool enabled) {
-    xTaskCreatePinnedToCore(sniffer_task, "sniffer_task", 4096, (void*)enabled, 17, NULL, I2C_SNIFFER_RUN_ON_CORE);
+bool i2c_sniffer_add_rule(const i2c_sniffer_rule_t& rule) {
+    portENTER_CRITICAL(&filter_mux);
+    bool ok = filter_rule_count < I2C_SNIFFER_MAX_RULES;
+    if (ok)
+        filter_rules[filter_rule_count++] = rule;
+    portEXIT_CRITICAL(&filter_mux);
+    compile_filter();
+    return ok;
+}
+
+void i2c_sniffer_clear_rules() {
+    portENTER_CRITICAL(&filter_mux);
+    filter_rule_count = 0;
+    portEXIT_CRITICAL(&filter_mux);
+    compile_filter();
+}
+
+void i2c_sniffer_set_default_drop(bool drop) {
+    portENTER_CRITICAL(&filter_mux);
+    filter_default_drop = drop;
+    portEXIT_CRITICAL(&filter_mux);
+    compile_filter();
 }
 
-void i2c_sniffer_enable() { enable_sda_intr(true); }
+bool i2c_sniffer_default_drop() { return filter_default_drop; }
 
-void i2c_sniffer_disable() {
-    enable_sda_intr(false);
-    vTaskDelay(1);
-    enable_sda_intr(false);
+size_t i2c_sniffer_rules(i2c_sniffer_rule_t* rules, size_t max) {
+    portENTER_CRITICAL(&filter_mux);
+    size_t n = std::min(max, filter_rule_count);
+    std::copy(filter_rules, filter_rules + n, rules);
+    portEXIT_CRITICAL(&filter_mux);
+    return n;
 }
 
+size_t i2c_sniffer_format(const sniffer_frame_t& f, char* buf, size_t buflen) {
+    static const char* const status[] = {"ok", "bad-checksum", "truncated"};
+    size_t len = 0;
+    if (buflen < 2)
+        return 0;
+    buf[len++] = '[';
+    for (size_t i = 0; i < f.len && len + 16 < buflen; ++i) {
+        if (i)
+            buf[len++] = ' ';
+        buf[len++] = toHex(f.data[i] >> 4);
+        buf[len++] = toHex(f.data[i] & 0xF);
+        if (!(f.ack[i / 8] & (1 << (i % 8))))
+            buf[len++] = '-';
+    }
+    int n = snprintf(buf + len, buflen - len, "] t=%lu d=%lu %s", (unsigned long)f.tm, (unsigned long)f.duration, status[f.status]);
+    return n < 0 ? len : std::min(len + n, buflen - 1);
+}
+
+void i2c_sniffer_enable() { enable_capture(true); }
+
+void i2c_sniffer_disable() { enable_capture(false); }
+
 void i2c_sniffer_pullup(bool enable) {
     if (enable) {
         gpio_pullup_en(PIN(I2C_SNIFFER_SCL_PIN));
@@ -138,3 +732,38 @@ void i2c_sniffer_pullup(bool enable) {
         gpio_pullup_dis(PIN(I2C_SNIFFER_SDA_PIN));
     }
 }
+
+size_t i2c_sniffer_encode(const sniffer_frame_t& f, uint8_t* buf, size_t buflen) {
+    // extend the 32-bit us timestamp, assuming at least one frame every ~71 minutes
+    static uint32_t last_tm, wraps;
+    if (!f.len)
+        return 0;
+    size_t n = f.len - 1;
+    size_t acklen = (n + 8) / 8;
+    size_t len = I2C_SNIFFER_RECORD_HEADER + acklen + n;
+    if (len > buflen)
+        return 0;
+    if (f.tm < last_tm)
+        ++wraps;
+    last_tm = f.tm;
+    uint64_t us = ((uint64_t)wraps << 32) | f.tm;
+    uint32_t sec = us / 1000000, usec = us % 1000000;
+    uint8_t flags = 0;
+    if (f.status == SNIFFER_FRAME_BAD_CHECKSUM)
+        flags |= I2C_SNIFFER_REC_BAD_CHECKSUM;
+    if (f.status == SNIFFER_FRAME_TRUNCATED)
+        flags |= I2C_SNIFFER_REC_TRUNCATED;
+    for (size_t i = 0; i < f.len; ++i) {
+        if (!(f.ack[i / 8] & (1 << (i % 8))))
+            flags |= I2C_SNIFFER_REC_NACK;
+    }
+    buf[0] = I2C_SNIFFER_RECORD_MAGIC;
+    buf[1] = n;
+    buf[2] = f.data[0];
+    buf[3] = flags;
+    memcpy(buf + 4, &sec, 4); // ESP32 is little endian
+    memcpy(buf + 8, &usec, 4);
+    memcpy(buf + I2C_SNIFFER_RECORD_HEADER, f.ack, acklen);
+    memcpy(buf + I2C_SNIFFER_RECORD_HEADER + acklen, f.data + 1, n);
+    return len;
+}
@@ -4,9 +4,108 @@
 #define I2C_SNIFFER_SDA_PIN      13
 #define I2C_SNIFFER_SCL_PIN      25
 #define I2C_SNIFFER_RUN_ON_CORE  1
-#define I2C_SNIFFER_PRINT_TIMING 0
+/*
+    1 = capture SCL and SDA with the RMT peripheral, one RX channel per line, and decode in the sniffer task: no interrupt per edge
+        and no busy-loop, the CPU only merges the captures after the frame (see i2c_capture.h). A frame must fit the channel memory,
+        one symbol per SCL clock (9 per byte), longer ones are reported truncated. 1 us resolution: standard mode (100 kHz) only.
+    0 = decode in the SDA interrupt handler, busy-looping for the whole frame (up to 14.9 ms)
+*/
+#define I2C_SNIFFER_RMT_CAPTURE     1
+#define I2C_SNIFFER_RMT_SCL_SYMBOLS 192  // 3 of the 8 RMT memory blocks of 64 symbols: frames up to 21 bytes
+#define I2C_SNIFFER_RMT_SDA_SYMBOLS 128  // 2 blocks, a symbol per two SDA changes; each DHT sensor takes one of the other 3
+#define I2C_SNIFFER_RMT_IDLE_US     3000 // a capture ends when its line didn't change for this long
+#define I2C_SNIFFER_RMT_ALIGN_US    50   // how far off the start of a capture may be, it is taken from the rx done interrupt time
+#define I2C_SNIFFER_FRAME_LEN       128
+#define I2C_SNIFFER_FRAME_POOL      8
+#define I2C_SNIFFER_MAX_RULES       8
+#define I2C_SNIFFER_BIT_HIST        32 // bit period histogram bins (1 us each, the last one counts everything longer)
 
-void i2c_sniffer_init(bool enabled);
+enum : uint8_t { SNIFFER_FRAME_OK = 0, SNIFFER_FRAME_BAD_CHECKSUM = 1, SNIFFER_FRAME_TRUNCATED = 2 };
+
+struct sniffer_frame_t {
+    uint32_t tm;       // us at START
+    uint32_t duration; // us from START to STOP
+    uint16_t len;
+    uint8_t status; // SNIFFER_FRAME_...
+    uint8_t ack[I2C_SNIFFER_FRAME_LEN / 8]; // bit set = byte was ACKed
+    uint8_t data[I2C_SNIFFER_FRAME_LEN];
+};
+
+struct i2c_sniffer_stats_t {
+    uint32_t good;
+    uint32_t bad_checksum;
+    uint32_t truncated;
+    uint32_t dropped;       // no free frame in the pool
+    uint32_t overflows;     // ring full
+    uint32_t passed;        // frames passed by the filter
+    uint32_t filtered;      // frames dropped by the filter
+    uint32_t lost_captures; // I2C_SNIFFER_RMT_CAPTURE: SCL captures without an SDA capture to merge with
+};
+
+// Bus timing statistics collected by the analyzer over one reporting period
+struct i2c_sniffer_timing_t {
+    uint32_t period_us; // length of the reporting period, the configured analyze period (+ up to one task wake-up)
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t bit_hist[I2C_SNIFFER_BIT_HIST]; // byte time / 9, per byte
+    uint32_t scl_hz;                         // estimated from bytes without clock stretching
+    uint32_t stretch_count;                  // bytes taking more than one extra bit period
+    uint32_t stretch_max_us;
+    uint32_t stretch_total_us;
+    uint32_t gap_count; // gaps between STOP and the next START
+    uint32_t gap_min_us;
+    uint32_t gap_max_us;
+    uint64_t gap_total_us;
+    uint64_t busy_us;          // START to STOP, summed
+    uint16_t utilization_pm;   // busy_us / period_us, per mille
+};
+
+// Filter rule, -1 matches anything. The first matching rule decides, frames not matching any rule get the default action.
+struct i2c_sniffer_rule_t {
+    int16_t addr;  // byte 0
+    int32_t code;  // bytes 2..3
+    int16_t flags; // byte 4
+    bool drop;
+};
+
+/*
+    Binary capture record (little endian):
+    u8  magic (I2C_SNIFFER_RECORD_MAGIC)
+    u8  N = payload length (not including the address byte)
+    u8  address byte (7-bit address << 1 | R/W)
+    u8  flags (I2C_SNIFFER_REC_...)
+    u32 timestamp, seconds
+    u32 timestamp, microseconds
+    u8  ACK bitmap[(N + 8) / 8], bit 0 = address byte
+    u8  payload[N]
+*/
+#define I2C_SNIFFER_RECORD_MAGIC  0xA5
+#define I2C_SNIFFER_RECORD_HEADER 12
+#define I2C_SNIFFER_RECORD_MAX    (I2C_SNIFFER_RECORD_HEADER + I2C_SNIFFER_FRAME_LEN / 8 + I2C_SNIFFER_FRAME_LEN)
+enum : uint8_t { I2C_SNIFFER_REC_BAD_CHECKSUM = 1, I2C_SNIFFER_REC_TRUNCATED = 2, I2C_SNIFFER_REC_NACK = 4 };
+
+// Called from the sniffer output task once per complete frame
+typedef void (*i2c_sniffer_callback_t)(const sniffer_frame_t& frame);
+// Called from the sniffer output task once per analyzer period
+typedef void (*i2c_sniffer_timing_callback_t)(const i2c_sniffer_timing_t& timing);
+
+void i2c_sniffer_init(bool enabled, i2c_sniffer_callback_t cb, i2c_sniffer_timing_callback_t timing_cb);
 void i2c_sniffer_enable();
 void i2c_sniffer_disable();
 void i2c_sniffer_pullup(bool enable);
+uint32_t i2c_sniffer_overflows();
+i2c_sniffer_stats_t i2c_sniffer_stats();
+/* formats the frame as "[82 60 C1 ...] t=<us> d=<us> <status>", NACKed bytes are followed by '-' */
+size_t i2c_sniffer_format(const sniffer_frame_t& frame, char* buf, size_t buflen);
+/* encodes the frame as a binary capture record, returns the record length or 0 if it doesn't fit */
+size_t i2c_sniffer_encode(const sniffer_frame_t& frame, uint8_t* buf, size_t buflen);
+/* returns false when the rule table is full */
+bool i2c_sniffer_add_rule(const i2c_sniffer_rule_t& rule);
+void i2c_sniffer_clear_rules();
+void i2c_sniffer_set_default_drop(bool drop);
+bool i2c_sniffer_default_drop();
+size_t i2c_sniffer_rules(i2c_sniffer_rule_t* rules, size_t max);
+/* analyzer mode: timing statistics instead of frame output, reported every period_s seconds (0 = off) */
+void i2c_sniffer_analyze(uint32_t period_s);
+uint32_t i2c_sniffer_analyze_period();
+size_t i2c_sniffer_format_timing(const i2c_sniffer_timing_t& timing, char* buf, size_t buflen);
@@ -0,0 +1,200 @@
+#include "itho_query.h"
+#include "i2c_master.h"
+#include "itho_reply.h"
+#include "util.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <string.h>
+
+static const char* TAG = "itho-query";
+
+struct query_t {
+    bool used;
+    uint16_t code;
+    uint8_t retries;
+    uint32_t timeout_ms;
+    int64_t deadline; // us
+    itho_query_callback_t cb;
+    void* arg;
+    size_t len;
+    uint8_t frame[7 + ITHO_QUERY_MAX_PAYLOAD];
+};
+
+static query_t queries[ITHO_QUERY_MAX_INFLIGHT];
+static portMUX_TYPE query_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t query_task_handle;
+
+static void reply_observer(uint16_t code, uint8_t flags, const uint8_t* payload, size_t len) {
+    if (flags != ITHO_REPLY_FLAGS)
+        return;
+    itho_query_callback_t cb = nullptr;
+    void* arg = nullptr;
+    portENTER_CRITICAL(&query_mux);
+    for (auto& q : queries) {
+        if (q.used && q.code == code) {
+            cb = q.cb;
+            arg = q.arg;
+            q.used = false;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&query_mux);
+    if (cb)
+        cb(ESP_OK, payload, len, arg);
+}
+
+// Resends queries whose reply is overdue and fails them after the last retry
+static void itho_query_task(void* arg) {
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        int64_t next = now + 1000000;
+        bool expired = false;
+        query_t resend[ITHO_QUERY_MAX_INFLIGHT];
+        size_t resend_count = 0;
+        itho_query_callback_t cb = nullptr;
+        void* cb_arg = nullptr;
+        portENTER_CRITICAL(&query_mux);
+        for (auto& q : queries) {
+            if (!q.used)
+                continue;
+            if (q.deadline <= now) {
+                if (q.retries) {
+                    --q.retries;
+                    q.deadline = now + q.timeout_ms * 1000LL;
+                    resend[resend_count++] = q;
+                } else if (!expired) {
+                    expired = true;
+                    cb = q.cb;
+                    cb_arg = q.arg;
+                    q.used = false;
+                    continue;
+                }
+            }
+            if (q.deadline < next)
+                next = q.deadline;
+        }
+        portEXIT_CRITICAL(&query_mux);
+        for (size_t i = 0; i < resend_count; ++i) {
+            ESP_LOGD(TAG, "Retry %02X%02X", resend[i].frame[2], resend[i].frame[3]);
+            if (i2c_master_send_async(resend[i].frame, resend[i].len, nullptr, nullptr) == ESP_OK)
+                continue;
+            // master queue full: the retry wasn't sent, give it back and try again shortly (unless the reply came meanwhile)
+            int64_t again = now + ITHO_QUERY_BUSY_RETRY_MS * 1000LL;
+            portENTER_CRITICAL(&query_mux);
+            for (auto& q : queries) {
+                if (q.used && q.code == resend[i].code) {
+                    ++q.retries;
+                    q.deadline = again;
+                    break;
+                }
+            }
+            portEXIT_CRITICAL(&query_mux);
+            if (again < next)
+                next = again;
+        }
+        if (expired) {
+            // handle further expired queries right away
+            if (cb)
+                cb(ESP_ERR_TIMEOUT, nullptr, 0, cb_arg);
+            continue;
+        }
+        TickType_t ticks = (next - now) / 1000 / portTICK_PERIOD_MS + 1;
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+
+void itho_query_init() {
+    itho_reply_set_observer(&reply_observer);
+    xTaskCreatePinnedToCore(itho_query_task, "itho_query", 3072, NULL, 9, &query_task_handle, 1);
+}
+
+esp_err_t itho_query(uint16_t code, const uint8_t* payload, size_t len, uint32_t timeout_ms, uint8_t retries, itho_query_callback_t cb, void* arg) {
+    if (len > ITHO_QUERY_MAX_PAYLOAD)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t frame[7 + ITHO_QUERY_MAX_PAYLOAD];
+    frame[0] = 0x82;
+    frame[1] = 0x80;
+    frame[2] = code >> 8;
+    frame[3] = code & 0xFF;
+    frame[4] = 0x04;
+    frame[5] = len;
+    if (len)
+        memcpy(frame + 6, payload, len);
+    fixChecksum(frame, 7 + len);
+
+    query_t* q = nullptr;
+    esp_err_t rc = ESP_OK;
+    portENTER_CRITICAL(&query_mux);
+    for (auto& s : queries) {
+        if (s.used && s.code == code) {
+            rc = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        if (!s.used && !q)
+            q = &s;
+    }
+    if (!rc && !q)
+        rc = ESP_ERR_NO_MEM;
+    if (!rc) {
+        q->used = true;
+        q->code = code;
+        q->retries = retries;
+        q->timeout_ms = timeout_ms;
+        q->deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+        q->cb = cb;
+        q->arg = arg;
+        q->len = 7 + len;
+        memcpy(q->frame, frame, q->len);
+    }
+    portEXIT_CRITICAL(&query_mux);
+    if (rc)
+        return rc;
+    rc = i2c_master_send_async(frame, 7 + len, nullptr, nullptr);
+    if (rc) {
+        portENTER_CRITICAL(&query_mux);
+        q->used = false;
+        portEXIT_CRITICAL(&query_mux);
+        return rc;
+    }
+    xTaskNotifyGive(query_task_handle);
+    return ESP_OK;
+}
+
+struct wait_t {
+    SemaphoreHandle_t done;
+    esp_err_t rc;
+    uint8_t* reply;
+    size_t reply_max;
+    size_t* reply_len;
+};
+
+static void wait_callback(esp_err_t rc, const uint8_t* payload, size_t len, void* arg) {
+    wait_t* w = (wait_t*)arg;
+    w->rc = rc;
+    if (w->reply_len)
+        *w->reply_len = 0;
+    if (!rc && w->reply) {
+        len = len < w->reply_max ? len : w->reply_max;
+        memcpy(w->reply, payload, len);
+        if (w->reply_len)
+            *w->reply_len = len;
+    }
+    xSemaphoreGive(w->done);
+}
+
+esp_err_t itho_query_wait(uint16_t code, const uint8_t* payload, size_t len, uint32_t timeout_ms, uint8_t retries, uint8_t* reply, size_t reply_max,
+                          size_t* reply_len) {
+    StaticSemaphore_t sem;
+    wait_t w = {xSemaphoreCreateBinaryStatic(&sem), ESP_OK, reply, reply_max, reply_len};
+    esp_err_t rc = itho_query(code, payload, len, timeout_ms, retries, &wait_callback, &w);
+    if (!rc) {
+        // the query always completes, by reply or by timeout
+        xSemaphoreTake(w.done, portMAX_DELAY);
+        rc = w.rc;
+    }
+    vSemaphoreDelete(w.done);
+    return rc;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ITHO_QUERY_MAX_INFLIGHT  4
+#define ITHO_QUERY_TIMEOUT_MS    200 // default wait for a reply before resending
+#define ITHO_QUERY_RETRIES       2   // default resends after a timeout
+#define ITHO_QUERY_MAX_PAYLOAD   32
+#define ITHO_QUERY_BUSY_RETRY_MS 10  // a resend that didn't fit the I2C master queue is tried again after this
+
+/*
+    Completion of a query: rc is ESP_OK with the reply payload, or ESP_ERR_TIMEOUT after the last retry (payload = nullptr).
+    Called from the I2C slave callback task (reply) or the itho_query task (timeout), so it must not block.
+*/
+typedef void (*itho_query_callback_t)(esp_err_t rc, const uint8_t* payload, size_t len, void* arg);
+
+/*
+    Request/response correlation for Itho queries: sends "82 80 <code> 04 <len> <payload> <checksum>" and completes
+    when a reply with the same code and flags 01 and a valid checksum arrives through itho_reply_dispatch().
+    Only one query per code can be in flight, as replies carry no request id.
+*/
+void itho_query_init();
+// Returns ESP_ERR_INVALID_STATE if the code is already in flight, ESP_ERR_NO_MEM if ITHO_QUERY_MAX_INFLIGHT is reached
+esp_err_t itho_query(uint16_t code, const uint8_t* payload, size_t len, uint32_t timeout_ms, uint8_t retries, itho_query_callback_t cb, void* arg);
+// Blocking variant, copies up to reply_max bytes of the reply payload to reply (may be nullptr)
+esp_err_t itho_query_wait(uint16_t code, const uint8_t* payload, size_t len, uint32_t timeout_ms, uint8_t retries, uint8_t* reply = nullptr,
+                          size_t reply_max = 0, size_t* reply_len = nullptr);
@@ -0,0 +1,48 @@
+#include "itho_reply.h"
+#include "util.h"
+
+struct reply_entry_t {
+    uint32_t key; // code << 8 | flags
+    itho_reply_handler_t handler;
+};
+
+static reply_entry_t handlers[ITHO_REPLY_MAX_HANDLERS];
+static size_t handler_count;
+static itho_reply_observer_t observer;
+
+bool itho_reply_register(uint16_t code, uint8_t flags, itho_reply_handler_t handler) {
+    uint32_t key = (uint32_t)code << 8 | flags;
+    for (size_t i = 0; i < handler_count; ++i) {
+        if (handlers[i].key == key) {
+            handlers[i].handler = handler;
+            return true;
+        }
+    }
+    if (handler_count >= ITHO_REPLY_MAX_HANDLERS)
+        return false;
+    handlers[handler_count++] = {key, handler};
+    return true;
+}
+
+void itho_reply_set_observer(itho_reply_observer_t o) { observer = o; }
+
+int itho_reply_dispatch(const uint8_t* data, size_t len) {
+    if (len <= ITHO_REPLY_HEADER_LEN || data[1] != 0x82 || ITHO_REPLY_HEADER_LEN + data[5] + 1u > len)
+        return ITHO_REPLY_MALFORMED;
+    size_t plen = data[5];
+    const uint8_t* payload = data + ITHO_REPLY_HEADER_LEN;
+    if (checksum(data, ITHO_REPLY_HEADER_LEN + plen) != payload[plen])
+        return ITHO_REPLY_BAD_CHECKSUM;
+    uint32_t key = (uint32_t)data[2] << 16 | data[3] << 8 | data[4];
+    int rc = ITHO_REPLY_UNKNOWN;
+    for (size_t i = 0; i < handler_count; ++i) {
+        if (handlers[i].key == key) {
+            handlers[i].handler(payload, plen);
+            rc = ITHO_REPLY_HANDLED;
+            break;
+        }
+    }
+    if (observer)
+        observer(data[2] << 8 | data[3], data[4], payload, plen);
+    return rc;
+}
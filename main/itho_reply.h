@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define ITHO_REPLY_MAX_HANDLERS 16
+
+// Reply frame as received by the slave: [0x80][0x82][code hi][code lo][flags][len][payload][checksum]
+#define ITHO_REPLY_HEADER_LEN 6
+#define ITHO_REPLY_FLAGS      0x01
+
+enum {
+    ITHO_REPLY_HANDLED,
+    ITHO_REPLY_UNKNOWN,      // well formed, but no handler registered for its code
+    ITHO_REPLY_BAD_CHECKSUM,
+    ITHO_REPLY_MALFORMED,    // not addressed to us, too short or length byte exceeds the frame
+};
+
+// Receives the payload of a validated reply (checksum excluded)
+typedef void (*itho_reply_handler_t)(const uint8_t* payload, size_t len);
+// Sees every validated reply after its handler ran, e.g. for request/response correlation
+typedef void (*itho_reply_observer_t)(uint16_t code, uint8_t flags, const uint8_t* payload, size_t len);
+
+/*
+    Registry of reply handlers keyed by message code and flags.
+    Has no ESP-IDF dependencies; register all handlers before the first dispatch.
+*/
+bool itho_reply_register(uint16_t code, uint8_t flags, itho_reply_handler_t handler);
+void itho_reply_set_observer(itho_reply_observer_t observer);
+// Validates the frame once and calls the matching handler; returns one of ITHO_REPLY_*
+int itho_reply_dispatch(const uint8_t* data, size_t len);
@@ -1,11 +1,19 @@
 #include "Config.h"
 #include "Nvs.h"
+#include "command.h"
+#include "command_batch.h"
 #include "console.h"
 #include "dht.h"
 #include "sht4x.h"
+#include "status.h"
+#include "telemetry.h"
+#include "text_writer.h"
 #include "i2c_master.h"
 #include "i2c_slave.h"
+#include "history.h"
 #include "i2c_sniffer.h"
+#include "itho_query.h"
+#include "itho_reply.h"
 #include "mqtt.h"
 #include "util.h"
 #include "wifi.h"
@@ -17,6 +25,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <string.h>
 
@@ -28,15 +37,22 @@ static uint32_t cmdlen = 0;
 static struct {
     int ret = -1, hum = -1, temp = -1;
 } dht_ret[max_sensors];
-static bool verbose = false, reportHex = false;
+static bool verbose = false, reportHex = false, reportSniff = false, reportSniffBin = false;
 
 Nvs nvs;
 Config config;
 
-bool sendBytes(const uint8_t* buf, size_t len) {
+static void sendBytesDone(esp_err_t rc, void* arg) {
+    if (rc || verbose) {
+        printf("Master send: %d\n", rc);
+    }
+}
+
+// Queues the bytes for sending, by default the result is printed when the send completes
+bool sendBytes(const uint8_t* buf, size_t len, i2c_master_callback_t cb = &sendBytesDone, void* arg = nullptr) {
     if (len) {
-        esp_err_t rc = i2c_master_send((char*)buf, len);
-        if (rc || verbose) {
+        esp_err_t rc = i2c_master_send_async(buf, len, cb, arg);
+        if (rc) {
             printf("Master send: %d\n", rc);
         }
         return rc == ESP_OK;
@@ -44,21 +60,432 @@ bool sendBytes(const uint8_t* buf, size_t len) {
     return false;
 }
 
-bool sendBytesHex(const char* hex, size_t hexlen) {
-    size_t len = parseHexStr(hex, hexlen, buf, sizeof(buf));
-    return sendBytes(buf, len);
+static void publish(const char* topic, const TextWriter& w) {
+    if (w.overflow()) {
+        ESP_LOGW(TAG, "Payload for %s truncated", topic);
+    }
+    mqtt_publish_bin(topic, w.c_str(), w.length());
+}
+
+// Only the newest pending message is sent, older ones are obsolete, and so are the messages of `supersedes` queued before it
+static void publishState(const char* topic, const TextWriter& w, const char* supersedes = nullptr) {
+    if (w.overflow()) {
+        ESP_LOGW(TAG, "Payload for %s truncated", topic);
+    }
+    mqtt_publish_state(topic, w.c_str(), w.length(), supersedes);
+}
+
+static void logAndPublish(const char* topic, const TextWriter& w) {
+    ESP_LOGI(TAG, "%s", w.c_str());
+    publish(topic, w);
+}
+
+static void writeSensor(TextWriter& w, int i) {
+    auto& ret = dht_ret[i];
+    w.fixed(ret.hum, 1).ch(',').fixed(ret.temp, 1).ch(',').num(ret.ret);
 }
 
 static void publishHumidity() {
-    char buf[20 * max_sensors];
-    int len = 0;
+    TextBuffer<24 * max_sensors + 4> w;
     for (int i = 0; i < max_sensors; i++) {
-        auto& ret = dht_ret[i];
-        len += snprintf(buf + len, sizeof(buf) - len, "%c%d.%d,%d.%d,%d", len ? ',' : '[', ret.hum / 10, ret.hum % 10, ret.temp / 10, ret.temp % 10,
-                 ret.ret);
+        w.ch(i ? ',' : '[');
+        writeSensor(w, i);
+    }
+    w.ch(']');
+    publishState("dht", w);
+}
+
+// Status values: the decoded status fields followed by humidity, temperature and result of each configured sensor
+#define STATUS_MAX_VALUES (STATUS_MAX_FIELDS + 3 * max_sensors)
+
+static uint16_t statusDeadband[STATUS_MAX_VALUES];
+static struct {
+    uint32_t full, delta, unchanged;
+} statusStats;
+
+static void parseDeadbands(const char* s) {
+    std::fill_n(statusDeadband, STATUS_MAX_VALUES, 0);
+    while (*s) {
+        char* end;
+        long i = strtol(s, &end, 10);
+        if (*end != ':')
+            break;
+        long v = strtol(end + 1, &end, 10);
+        if (i >= 0 && i < STATUS_MAX_VALUES && v >= 0)
+            statusDeadband[i] = std::min(v, 0xFFFFL);
+        s = *end == ',' ? end + 1 : end;
+    }
+}
+
+static void writeDeadbands(TextWriter& w) {
+    bool first = true;
+    for (int i = 0; i < STATUS_MAX_VALUES; ++i) {
+        if (statusDeadband[i]) {
+            if (!first)
+                w.ch(',');
+            w.num(i).ch(':').num(statusDeadband[i]);
+            first = false;
+        }
     }
-    strncpy(buf + len, "]", sizeof(buf) - 1);
-    mqtt_publish("esp-data-dht", buf);
+}
+
+/*
+    Adaptive status polling: the interval starts at config.poll_min, doubles after every poll without a change beyond the
+    deadbands up to config.poll_max, and goes back to poll_min when values change or a set command is sent.
+*/
+#define POLL_BASELINE_S    5  // the former fixed interval, to count saved polls against
+#define POLL_FAST_WINDOW_S 60 // keep polling at poll_min this long after a set command
+
+static TaskHandle_t statusLoopTask;
+static volatile bool statusChanged;
+static int64_t pollFastUntil;
+static struct {
+    uint32_t interval; // s
+    uint32_t polls;
+    uint32_t elapsed; // s spent polling, connected or not (the loop keeps polling while MQTT is down), polls at POLL_BASELINE_S would have been elapsed / POLL_BASELINE_S
+} pollStats;
+
+// Restarts fast polling, e.g. after a set command
+static void pollSoon() {
+    pollFastUntil = esp_timer_get_time() + POLL_FAST_WINDOW_S * 1000000LL;
+    if (statusLoopTask)
+        xTaskNotifyGive(statusLoopTask);
+}
+
+static void writePollStats(TextWriter& w) {
+    w.str("poll: min=").num(config.poll_min).str(" max=").num(config.poll_max).str(" interval=").num(pollStats.interval);
+    w.str(" polls=").num(pollStats.polls).str(" saved=").num((int64_t)(pollStats.elapsed / POLL_BASELINE_S) - pollStats.polls);
+}
+
+// History of selected status values, see history.h
+static History history;
+static portMUX_TYPE history_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t historyIndex[HISTORY_MAX_SERIES]; // status value index of each series
+static uint8_t historyDecimals[HISTORY_MAX_SERIES];
+static bool historyConfigured; // false = pick the default series from the first status
+
+static void parseHistorySeries(const char* s) {
+    size_t n = 0;
+    while (*s && n < HISTORY_MAX_SERIES) {
+        char* end;
+        long i = strtol(s, &end, 10);
+        if (end == s)
+            break;
+        if (i >= 0 && i < STATUS_MAX_VALUES)
+            historyIndex[n++] = i;
+        s = *end == ',' ? end + 1 : end;
+    }
+    portENTER_CRITICAL(&history_mux);
+    history.reset(n);
+    portEXIT_CRITICAL(&history_mux);
+    historyConfigured = n > 0;
+}
+
+static void writeHistoryInfo(TextWriter& w) {
+    w.str("history: series=");
+    for (size_t i = 0; i < history.series(); ++i)
+        w.ch(i ? ',' : '[').num(historyIndex[i]);
+    w.str(history.series() ? "]" : "[]").str(" memory=").num(History::memory());
+    static const char* names[] = {" 5s=", " 1m=", " 1h="};
+    for (int k = 0; k < History::TIERS; ++k)
+        w.str(names[k]).num(history.count(k)).ch('/').num(history.capacity(k));
+}
+
+// Binary telemetry batches, see telemetry.h; only used in the I2C slave callback task
+static uint8_t telemetryBuf[2048];
+static TelemetryEncoder telemetry(telemetryBuf, sizeof(telemetryBuf));
+static struct {
+    uint32_t json_samples, json_bytes, bin_samples, bin_bytes;
+} telemetryStats;
+
+static void flushTelemetry() {
+    if (!telemetry.samples())
+        return;
+    mqtt_publish_bin("bin", (const char*)telemetry.data(), telemetry.length());
+    telemetryStats.bin_samples += telemetry.samples();
+    telemetryStats.bin_bytes += telemetry.length();
+    telemetry.clear();
+}
+
+static void writeTelemetryStats(TextWriter& w) {
+    auto& st = telemetryStats;
+    w.str("telemetry: batch=").num(config.telemetry_batch).str(" json_bytes_per_sample=");
+    w.fixed(st.json_samples ? st.json_bytes * 10ULL / st.json_samples : 0, 1).str(" bin_bytes_per_sample=");
+    w.fixed(st.bin_samples ? st.bin_bytes * 10ULL / st.bin_samples : 0, 1);
+}
+
+static void publishStats() {
+    TextBuffer<192> w;
+    auto st = i2c_sniffer_stats();
+    w.str("sniffer: good=").num(st.good).str(" bad_checksum=").num(st.bad_checksum).str(" truncated=").num(st.truncated);
+    w.str(" dropped=").num(st.dropped).str(" overflows=").num(st.overflows).str(" passed=").num(st.passed).str(" filtered=").num(st.filtered);
+#if I2C_SNIFFER_RMT_CAPTURE
+    w.str(" lost_captures=").num(st.lost_captures);
+#endif
+    logAndPublish("data", w);
+
+    auto sl = i2c_slave_stats();
+    w.clear();
+    w.str("slave: frames=").num(sl.frames).str(" timeouts=").num(sl.timeouts).str(" pool_exhausted=").num(sl.pool_exhausted);
+    w.str(" queue=").num(sl.queue_depth).ch('/').num(sl.queue_max).str(" latency_ms:");
+    for (int i = 0; i < I2C_SLAVE_LATENCY_BINS; ++i) {
+        if (i < I2C_SLAVE_LATENCY_BINS - 1)
+            w.str(" <").num(i2c_slave_latency_bins_ms[i]);
+        else
+            w.str(" >=").num(i2c_slave_latency_bins_ms[i - 1]);
+        w.ch('=').num(sl.latency_hist[i]);
+    }
+    logAndPublish("data", w);
+
+    w.clear();
+    w.str("status: full=").num(statusStats.full).str(" delta=").num(statusStats.delta).str(" unchanged=").num(statusStats.unchanged);
+    logAndPublish("data", w);
+
+    w.clear();
+    writePollStats(w);
+    logAndPublish("data", w);
+
+    auto mq = mqtt_publish_stats();
+    w.clear();
+    w.str("mqtt: published=").num(mq.published).str(" dropped=").num(mq.dropped).str(" coalesced=").num(mq.coalesced);
+    w.str(" expired=").num(mq.expired).str(" superseded=").num(mq.superseded);
+    w.str(" evicted=").num(mq.evicted).str(" queued=").num(mq.queued).str(" high_water=").num(mq.high_water);
+    w.str(" replayed=").num(mq.replay_done).ch('/').num(mq.replay_total);
+    logAndPublish("data", w);
+
+    w.clear();
+    writeHistoryInfo(w);
+    logAndPublish("data", w);
+
+    w.clear();
+    writeTelemetryStats(w);
+    logAndPublish("data", w);
+}
+
+// Hex value up to max, or "*" / missing = any (-1); false when invalid
+static bool parseFilterField(const char* tok, long max, int32_t& value) {
+    if (!tok || strcmp(tok, "*") == 0) {
+        value = -1;
+        return true;
+    }
+    char* end;
+    long v = strtol(tok, &end, 16);
+    if (end == tok || *end || v < 0 || v > max)
+        return false;
+    value = v;
+    return true;
+}
+
+/*
+    filter                                  - list the rules
+    filter clear                            - remove all rules
+    filter default pass|drop                - action for frames not matching any rule
+    filter pass|drop ADDR [CODE [FLAGS]]    - add a rule, hex values or * for any (e.g. "filter drop 82 A401 *")
+*/
+static bool processFilterCommand(const char* data, int data_len) {
+    char args[64];
+    char* save = nullptr;
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+    const char* tok = strtok_r(args, " ", &save);
+    if (tok && (strcmp(tok, "pass") == 0 || strcmp(tok, "drop") == 0)) {
+        i2c_sniffer_rule_t rule{};
+        rule.drop = tok[0] == 'd';
+        const char* addr = strtok_r(nullptr, " ", &save); // required, a rule for all frames needs an explicit *
+        int32_t fields[3];
+        if (!addr || !parseFilterField(addr, 0xFF, fields[0]) || !parseFilterField(strtok_r(nullptr, " ", &save), 0xFFFF, fields[1]) ||
+            !parseFilterField(strtok_r(nullptr, " ", &save), 0xFF, fields[2]) || strtok_r(nullptr, " ", &save)) {
+            ESP_LOGE(TAG, "Invalid filter rule, expected pass|drop ADDR [CODE [FLAGS]]");
+            return false;
+        }
+        rule.addr = fields[0];
+        rule.code = fields[1];
+        rule.flags = fields[2];
+        if (!i2c_sniffer_add_rule(rule)) {
+            ESP_LOGE(TAG, "Too many filter rules");
+            return false;
+        }
+    } else if (tok && strcmp(tok, "clear") == 0) {
+        i2c_sniffer_clear_rules();
+    } else if (tok && strcmp(tok, "default") == 0) {
+        tok = strtok_r(nullptr, " ", &save);
+        if (!tok || (strcmp(tok, "pass") != 0 && strcmp(tok, "drop") != 0)) {
+            ESP_LOGE(TAG, "Invalid filter default, expected pass|drop");
+            return false;
+        }
+        i2c_sniffer_set_default_drop(strcmp(tok, "drop") == 0);
+    } else if (tok) {
+        ESP_LOGE(TAG, "Invalid filter command");
+        return false;
+    }
+    i2c_sniffer_rule_t rules[I2C_SNIFFER_MAX_RULES];
+    size_t n = i2c_sniffer_rules(rules, I2C_SNIFFER_MAX_RULES);
+    TextBuffer<24 * I2C_SNIFFER_MAX_RULES + 32> w;
+    w.str("filter:");
+    for (size_t i = 0; i < n; ++i) {
+        const auto& r = rules[i];
+        w.str(r.drop ? " drop " : " pass ");
+        r.addr >= 0 ? w.hex(r.addr) : w.ch('*');
+        w.ch(' ');
+        r.code >= 0 ? w.hex(r.code >> 8).hex(r.code) : w.ch('*');
+        w.ch(' ');
+        r.flags >= 0 ? w.hex(r.flags) : w.ch('*');
+        w.ch(',');
+    }
+    w.str(" default ").str(i2c_sniffer_default_drop() ? "drop" : "pass");
+    logAndPublish("data", w);
+    return true;
+}
+
+// Decimal value in 0..max; false when invalid
+static bool parseDecimal(const char* tok, long max, long& value) {
+    char* end;
+    value = tok ? strtol(tok, &end, 10) : -1;
+    return tok && end != tok && !*end && value >= 0 && value <= max;
+}
+
+/*
+    deadband                    - list the deadbands and keyframe interval
+    deadband INDEX|* VALUE      - publish a status value only when it moved more than VALUE units of its last digit
+    deadband clear              - publish every change
+    deadband keyframe N         - publish the full status every N intervals and only changes in between, 0 = always in full
+*/
+static bool processDeadbandCommand(const char* data, int data_len) {
+    char args[32];
+    char* save = nullptr;
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+    const char* tok = strtok_r(args, " ", &save);
+    const char* val = tok ? strtok_r(nullptr, " ", &save) : nullptr;
+    if (tok) {
+        long index, value;
+        if (strcmp(tok, "clear") == 0) {
+            std::fill_n(statusDeadband, STATUS_MAX_VALUES, 0);
+        } else if (strcmp(tok, "keyframe") == 0 && parseDecimal(val, 0xFFFF, value)) {
+            config.keyframe_interval = value;
+        } else if (strcmp(tok, "*") == 0 && parseDecimal(val, 0xFFFF, value)) {
+            std::fill_n(statusDeadband, STATUS_MAX_VALUES, value);
+        } else if (parseDecimal(tok, STATUS_MAX_VALUES - 1, index) && parseDecimal(val, 0xFFFF, value)) {
+            statusDeadband[index] = value;
+        } else {
+            ESP_LOGE(TAG, "Invalid deadband command, values must be 0..65535");
+            return false;
+        }
+        TextBuffer<8 * STATUS_MAX_VALUES> db;
+        writeDeadbands(db);
+        config.deadbands = db.c_str();
+        if (!config.Write()) {
+            ESP_LOGE(TAG, "Config write failed");
+        }
+    }
+    TextBuffer<8 * STATUS_MAX_VALUES + 32> w;
+    w.str("deadband: keyframe=").num(config.keyframe_interval).ch(' ');
+    writeDeadbands(w);
+    logAndPublish("data", w);
+    return true;
+}
+
+#define HISTORY_COPY      4                                  // buckets copied per history_mux section
+#define HISTORY_ENTRY_MAX (12 + 3 * HISTORY_MAX_SERIES * 22) // JSON of one bucket
+
+// Publishes the buckets of a history tier starting in from..to (uptime s) in JSON chunks of at most 1 KB
+static void publishHistory(int tier, uint32_t from, uint32_t to) {
+    static const char* names[] = {"5s", "1m", "1h"};
+    uint32_t now = esp_timer_get_time() / 1000000;
+    TextBuffer<1024> w;
+    size_t count = 0;
+    auto begin = [&] {
+        w.clear();
+        w.str("{\"tier\":\"").str(names[tier]).str("\",\"now\":").num(now).str(",\"series\":[");
+        for (size_t i = 0; i < history.series(); ++i) {
+            if (i)
+                w.ch(',');
+            w.num(historyIndex[i]);
+        }
+        w.str("],\"samples\":[");
+        count = 0;
+    };
+    History::entry_t copy[HISTORY_COPY];
+    size_t cursor = 0, n = 0, next = 0;
+    begin();
+    for (;;) {
+        if (next == n) {
+            portENTER_CRITICAL(&history_mux);
+            n = history.read(tier, from, to, cursor, copy, HISTORY_COPY);
+            portEXIT_CRITICAL(&history_mux);
+            next = 0;
+            if (!n)
+                break;
+        }
+        if (w.available() < HISTORY_ENTRY_MAX) {
+            w.str("]}");
+            publish("history", w);
+            begin();
+        }
+        const History::entry_t& e = copy[next++];
+        w.str(count++ ? ",[" : "[").num(e.t);
+        for (size_t i = 0; i < history.series(); ++i)
+            w.ch(',').fixed(e.min[i], historyDecimals[i]).ch(',').fixed(e.avg[i], historyDecimals[i]).ch(',').fixed(e.max[i], historyDecimals[i]);
+        w.ch(']');
+    }
+    w.str("]}");
+    publish("history", w);
+}
+
+/*
+    history                     - recorded series, memory use and fill level of the tiers
+    history track [INDEX ...]   - record these status values (at most HISTORY_MAX_SERIES), none = default; clears the history
+    history 5s|1m|1h [SECONDS]  - publish the buckets of the last SECONDS (default all) to the history topic
+    history 5s|1m|1h FROM TO    - publish the buckets starting from FROM to TO (uptime s, as "now" in the messages)
+*/
+static bool processHistoryCommand(const char* data, int data_len) {
+    char args[64];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+    char* s = args;
+    while (*s == ' ')
+        ++s;
+    if (strncmp(s, "track", 5) == 0 && (s[5] == ' ' || !s[5])) {
+        char* save = nullptr;
+        TextBuffer<4 * HISTORY_MAX_SERIES> series;
+        size_t n = 0;
+        for (const char* tok = strtok_r(s + 5, " ", &save); tok; tok = strtok_r(nullptr, " ", &save)) {
+            long index;
+            if (n == HISTORY_MAX_SERIES || !parseDecimal(tok, STATUS_MAX_VALUES - 1, index)) {
+                ESP_LOGE(TAG, "Invalid history series, expected at most %d status value indexes 0..%d", HISTORY_MAX_SERIES,
+                         STATUS_MAX_VALUES - 1);
+                return false;
+            }
+            series.str(n++ ? "," : "").num(index);
+        }
+        config.history_series = series.c_str();
+        if (!config.Write()) {
+            ESP_LOGE(TAG, "Config write failed");
+        }
+        parseHistorySeries(config.history_series.c_str());
+    } else if (*s) {
+        int tier = strncmp(s, "5s", 2) == 0 ? History::TIER_5S : strncmp(s, "1m", 2) == 0 ? History::TIER_1M : strncmp(s, "1h", 2) == 0 ? History::TIER_1H : -1;
+        if (tier < 0 || (s[2] != ' ' && s[2])) {
+            ESP_LOGE(TAG, "Invalid history command");
+            return false;
+        }
+        char* end;
+        long first = strtol(s + 2, &end, 10);
+        long second = strtol(end, &end, 10);
+        while (*end == ' ')
+            ++end;
+        uint32_t now = esp_timer_get_time() / 1000000;
+        if (first < 0 || second < 0 || *end) {
+            ESP_LOGE(TAG, "Invalid history command");
+            return false;
+        }
+        if (second)
+            publishHistory(tier, first, second);
+        else
+            publishHistory(tier, first && first < now ? now - first : 0, UINT32_MAX);
+        return true;
+    }
+    TextBuffer<128> w;
+    writeHistoryInfo(w);
+    logAndPublish("data", w);
+    return true;
 }
 
 static uint8_t set1[]{0x82, 0x60, 0xC1, 0x01, 0x01, 0x11, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF,
@@ -79,70 +506,19 @@ static void initRFTKey(uint32_t rftKey) {
 
 static int64_t lastSetTime;
 
-static void processCommand(const char* data, int data_len) {
-    if (strncmp("set1", data, data_len) == 0) {
+// Ventilation level 1-3 (3 = high for 30 min), completion as for sendBytes
+static bool setLevel(int level, i2c_master_callback_t cb = &sendBytesDone, void* arg = nullptr) {
+    bool ok;
+    if (level == 1) {
         lastSetTime = std::max(lastSetTime, esp_timer_get_time()) + 3600 * 1000000LL;
-        sendBytes(set1, sizeof(set1));
-    } else if (strncmp("set2", data, data_len) == 0) {
-        sendBytes(set2, sizeof(set2));
-    } else if (strncmp("set3", data, data_len) == 0) { // 30min
-        sendBytes(set3, sizeof(set3));
-    }
-    // } else if (strncmp("sniff0", data, data_len) == 0) {
-    //     i2c_sniffer_disable();
-    //     reportHex = false;
-    //     mqtt_publish("esp-data", "sniffer off");
-    // } else if (strncmp("sniff1", data, data_len) == 0) {
-    //     i2c_sniffer_enable();
-    //     reportHex = true;
-    //     mqtt_publish("esp-data", "sniffer on");
-    // } else if (strncmp("rftkey", data, 6) == 0) {
-    //     unsigned i = 6;
-    //     while (data[i] == ' ')
-    //         i++;
-    //     if (i < data_len) {
-    //         uint32_t key = 0;
-    //         parseHexStr(data + i, data_len - i, (uint8_t*)&key, 4);
-    //         if (key) {
-    //             config.rftKey = key;
-    //             initRFTKey(config.rftKey);
-    //             if (!config.Write()) {
-    //                 ESP_LOGE(TAG, "Config write failed");
-    //             }
-    //         }
-    //     }
-    //     std::string s = "rftkey=";
-    //     s += toHexStr((uint8_t*)&config.rftKey, 4);
-    //     mqtt_publish("esp-data", s.c_str());
-    else if (strncmp("high_hum_threshold", data, 18) == 0) {
-        unsigned i = 18;
-        while (data[i] == ' ')
-            i++;
-        if (i < data_len) {
-            std::string hum_str(data + i, data + data_len);
-            int hum = atoi(hum_str.c_str());
-            if (hum < 100 || hum > 1000) {
-                std::string buf = "invalid parameter value " + hum_str;
-                ESP_LOGE(TAG, "%s", buf.c_str());
-                mqtt_publish("esp-data-dht", buf.c_str());
-                return;
-            }
-            config.high_hum_threshold = Config::normalize_high_hum_threshold(hum);
-            if (!config.Write()) {
-                ESP_LOGE(TAG, "Config write failed");
-            }
-        }
-        int hum1 = config.high_hum_threshold / 10, hum2 = config.high_hum_threshold % 10;
-        std::string buf = "high_hum_threshold=" + std::to_string(hum1) + '.' + std::to_string(hum2);
-        ESP_LOGI(TAG, "%s", buf.c_str());
-        mqtt_publish("esp-data-dht", buf.c_str());
-    } else if (strncmp("hum", data, data_len) == 0) {
-        publishHumidity();
-    } else if (isHex(data[0])) {
-        sendBytesHex(data, data_len);
+        ok = sendBytes(set1, sizeof(set1), cb, arg);
+    } else if (level == 2) {
+        ok = sendBytes(set2, sizeof(set2), cb, arg);
     } else {
-        ESP_LOGE(TAG, "Unknown command '%s'", std::string(data, data + data_len).c_str());
+        ok = sendBytes(set3, sizeof(set3), cb, arg);
     }
+    pollSoon();
+    return ok;
 }
 
 static const int mode_set_max_freq_sec = 600; // set mode at most once every 10 min
@@ -157,66 +533,98 @@ static void handleHumidity() {
         int64_t now = esp_timer_get_time();
         if (now - lastSetTime >= mode_set_max_freq_sec * 1000000) {
             ESP_LOGI(TAG, "High humidity, setting mode 3");
-            processCommand("set3", 4);
+            setLevel(3);
         }
     }
     prev_hum = hum;
 }
 
-static void processConsoleCommand() {
-    if (strcmp(cmd, "p") == 0) {
-        i2c_sniffer_pullup(false);
-        printf("Pullup OFF\n");
-    } else if (strcmp(cmd, "P") == 0) {
-        i2c_sniffer_pullup(true);
-        printf("Pullup ON\n");
-    } else if (strcmp(cmd, "s") == 0) {
-        i2c_sniffer_disable();
-        printf("Sniffer OFF\n");
-    } else if (strcmp(cmd, "S") == 0) {
-        i2c_sniffer_enable();
-        printf("Sniffer ON\n");
-    } else if (strcmp(cmd, "h") == 0) {
-        reportHex = false;
-        printf("esp-data-hex reporting OFF\n");
-    } else if (strcmp(cmd, "H") == 0) {
-        reportHex = true;
-        printf("esp-data-hex reporting ON\n");
-    } else if (strcmp(cmd, "r") == 0) {
-        printf("Restarting\n");
-        vTaskDelay(configTICK_RATE_HZ / 4);
-        esp_restart();
-    } else if (strcmp("config", cmd) == 0) {
-        if (config.Reconfigure()) {
-            i2c_sniffer_enable();
-            printf("Sniffer is ON.\n"
-                   "Press any key on the RFT device, watching for a message that looks like:\n"
-                   "82 60 C1 01 01 11 .. .. .. .. xx xx xx xx .. .. .. .. .. .. .. .. .. ..\n"
-                   "The RFT ID will be the values xx xx xx xx.\n"
-                   "Write those down, then turn off the sniffer with the 's' command.\n");
-        }
-    } else {
-        processCommand(cmd, strlen(cmd));
+portMUX_TYPE status_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool haveDatatypes;
+
+// MQTT 5: reply to the pending status request with the next status
+static mqtt_response_t statusResponse;
+static bool statusResponsePending;
+
+static StatusPlan statusPlan;
+
+// The A4 00 status format is cached in NVS together with the device identity (90 E0 reply) it was fetched from
+static Nvs cacheNvs("cache");
+static uint32_t deviceIdentity; // manufacturer, type, HW version, list version
+static bool haveDeviceIdentity, identityChecked;
+static int64_t identityRetryTime; // us, no 90 E0 query before this after one failed
+#define IDENTITY_RETRY_S 600
+static uint32_t cachedIdentity;
+static bool haveCachedFormat;
+
+static void loadStatusFormatCache() {
+    if (!cacheNvs.StartRead())
+        return;
+    cachedIdentity = cacheNvs.ReadInt("ident");
+    std::string format = cacheNvs.ReadString("format");
+    cacheNvs.EndRead();
+    if (!format.empty()) {
+        statusPlan.compile((const uint8_t*)format.data(), format.size());
+        haveDatatypes = haveCachedFormat = true;
+        ESP_LOGI(TAG, "Using cached status format (%d fields) for device %08lX", (int)format.size(), (unsigned long)cachedIdentity);
     }
 }
 
-portMUX_TYPE status_mux = portMUX_INITIALIZER_UNLOCKED;
-std::string datatypes;
+static void saveStatusFormatCache(const uint8_t* data, size_t len) {
+    if (!haveDeviceIdentity || (haveCachedFormat && cachedIdentity == deviceIdentity))
+        return;
+    if (cacheNvs.StartWrite()) {
+        cacheNvs.WriteInt("ident", deviceIdentity);
+        cacheNvs.WriteString("format", std::string((const char*)data, len));
+        if (cacheNvs.EndWrite()) {
+            cachedIdentity = deviceIdentity;
+            haveCachedFormat = true;
+        }
+    }
+}
 
-static void requestStatus() {
-    for (int i = 0; i < 3; ++i) {
+// Fetches the device identity once per boot and drops a cached status format that belongs to another device
+static void validateStatusFormatCache() {
+    int64_t now = esp_timer_get_time();
+    if (identityChecked || now < identityRetryTime)
+        return;
+    if (itho_query_wait(0x90E0, nullptr, 0, ITHO_QUERY_TIMEOUT_MS, ITHO_QUERY_RETRIES) != ESP_OK) {
+        // a device without 90 E0 would otherwise cost all query retries on every poll
+        identityRetryTime = now + IDENTITY_RETRY_S * 1000000LL;
+        return;
+    }
+    identityChecked = true;
+    if (haveCachedFormat && cachedIdentity != deviceIdentity) {
+        ESP_LOGW(TAG, "Device identity changed from %08lX to %08lX, refetching the status format", (unsigned long)cachedIdentity,
+                 (unsigned long)deviceIdentity);
+        haveCachedFormat = false;
         portENTER_CRITICAL(&status_mux);
-        bool haveDatatypes = !datatypes.empty();
+        haveDatatypes = false;
         portEXIT_CRITICAL(&status_mux);
-        if (haveDatatypes)
-            break;
-        sendBytesHex("82 80 A4 00 04 00 56", 20);
-        vTaskDelay(configTICK_RATE_HZ / 5);
+        if (cacheNvs.StartWrite())
+            cacheNvs.EndWrite();
+    }
+}
+
+static esp_err_t requestStatus() {
+    portENTER_CRITICAL(&status_mux);
+    bool compiled = haveDatatypes;
+    portEXIT_CRITICAL(&status_mux);
+    if (!compiled) {
+        // the identity is needed to cache the format
+        validateStatusFormatCache();
+        // the A4 00 reply handler compiles the status plan before the query completes
+        if (itho_query_wait(0xA400, nullptr, 0, ITHO_QUERY_TIMEOUT_MS, ITHO_QUERY_RETRIES) != ESP_OK) {
+            ESP_LOGW(TAG, "Unable to fetch data types");
+        }
     }
-    if (datatypes.empty()) {
-        ESP_LOGW(TAG, "Unable to fetch data types");
+    esp_err_t rc = itho_query_wait(0xA401, nullptr, 0, ITHO_QUERY_TIMEOUT_MS, ITHO_QUERY_RETRIES);
+    if (rc) {
+        ESP_LOGW(TAG, "Status query failed: %d", rc);
     }
-    sendBytesHex("82 80 A4 01 04 00 55", 20);
+    // a cached format is used for the first status right away and checked afterwards
+    validateStatusFormatCache();
+    return rc;
 }
 
 static void requestStatusTask(void* arg) {
@@ -225,114 +633,758 @@ static void requestStatusTask(void* arg) {
 }
 
 static void requestStatusLoopTask(void* arg) {
+    pollStats.interval = config.poll_min;
     for (;;) {
-        vTaskDelay(5 * configTICK_RATE_HZ);
-        if (mqtt_is_connected()) {
-            requestStatus();
+        // pollSoon() cuts the wait short and restarts at the minimum interval
+        if (ulTaskNotifyTake(pdTRUE, pollStats.interval * configTICK_RATE_HZ)) {
+            pollStats.interval = config.poll_min;
+            continue;
         }
+        // Also while MQTT is down: the history keeps recording and the messages are queued until it is back
+        pollStats.elapsed += pollStats.interval;
+        statusChanged = false;
+        requestStatus();
+        ++pollStats.polls;
+        if (statusChanged || esp_timer_get_time() < pollFastUntil)
+            pollStats.interval = config.poll_min;
+        else
+            pollStats.interval = std::min<uint32_t>(pollStats.interval * 2, config.poll_max);
     }
     vTaskDelete(nullptr);
 }
 
-/*
-    Data format (1 byte):
-    bit 7: signed / unsigned
-    bits 6..4: size (2^n): 0=1, 1=2, 2=4
-    bits 3..0: decimal digits (divider 10^n)
-*/
-void handleStatus(const uint8_t* data, size_t len) {
-    std::string s;
-    char buf[64];
-    s.reserve(4 * len + 4);
-    s = "[";
-    size_t i = 0;
-    for (uint8_t dt : datatypes) {
-        if (i >= len)
-            break;
-        if (s.length() > 1)
-            s += ',';
-        int32_t x = (dt & 0x80) ? (int8_t)data[i++] : data[i++];
-        for (int j = (1 << ((dt >> 4) & 3)); j > 1; --j) {
-            x = (x << 8) | data[i++];
+// Status publishing state, only used in the I2C slave callback task
+static int64_t statusValues[STATUS_MAX_VALUES];
+static uint8_t statusDecimals[STATUS_MAX_VALUES];
+static int64_t publishedValues[STATUS_MAX_VALUES];
+static int64_t polledValues[STATUS_MAX_VALUES]; // previous poll, for the polling scheduler
+static size_t polledCount;
+static size_t publishedCount;
+static uint16_t intervalsSinceKeyframe;
+
+// Full status as a JSON array on the status topic
+static const TextWriter& formatStatusFull(size_t n) {
+    static TextBuffer<24 * STATUS_MAX_VALUES> w;
+    w.clear();
+    w.ch('[');
+    for (size_t i = 0; i < n; ++i) {
+        if (i)
+            w.ch(',');
+        w.fixed(statusValues[i], statusDecimals[i]);
+    }
+    w.ch(']');
+    ++telemetryStats.json_samples;
+    telemetryStats.json_bytes += w.length();
+    return w;
+}
+
+static void publishStatusFull(size_t n) {
+    // the deltas to the previous keyframe are useless once this one is sent, e.g. when catching up after a reconnect
+    publishState("status", formatStatusFull(n), "delta");
+    std::copy_n(statusValues, n, publishedValues);
+    publishedCount = n;
+    ++statusStats.full;
+}
+
+// Values that moved beyond their deadband since they were last published, as a JSON object {"INDEX":VALUE,...} on the delta topic
+static void publishStatusDelta(size_t n) {
+    static TextBuffer<32 * STATUS_MAX_VALUES> w;
+    w.clear();
+    for (size_t i = 0; i < n; ++i) {
+        int64_t d = statusValues[i] - publishedValues[i];
+        if (d == 0 || (d < 0 ? -d : d) <= statusDeadband[i])
+            continue;
+        w.str(w.length() ? ",\"" : "{\"").num(i).str("\":").fixed(statusValues[i], statusDecimals[i]);
+        publishedValues[i] = statusValues[i];
+    }
+    if (!w.length()) {
+        ++statusStats.unchanged;
+        return;
+    }
+    w.ch('}');
+    publish("delta", w);
+    ++statusStats.delta;
+}
+
+// Status sample batched into the bin topic instead of JSON on the status topic
+static void publishStatusBinary(size_t n) {
+    // the size the JSON status would have had, for the bytes per sample comparison in the stats
+    size_t json = n ? n + 1 : 2;
+    for (size_t i = 0; i < n; ++i)
+        json += fixedLength(statusValues[i], statusDecimals[i]);
+    ++telemetryStats.json_samples;
+    telemetryStats.json_bytes += json;
+    uint32_t now = esp_timer_get_time() / 1000000;
+    if (!telemetry.fits(statusDecimals, n))
+        flushTelemetry();
+    if (!telemetry.add(now, statusValues, statusDecimals, n)) {
+        ESP_LOGW(TAG, "Status sample does not fit a telemetry batch");
+        return;
+    }
+    if (telemetry.samples() >= config.telemetry_batch)
+        flushTelemetry();
+}
+
+static void recordHistory(size_t n) {
+    if (!historyConfigured) {
+        // default: humidity and temperature of the sensors, then the first status fields
+        size_t series = 0, sensors = n;
+        for (int i = 0; i < max_sensors; i++) {
+            if (config.sensors[i].type)
+                sensors -= 3;
         }
-        int rem = dt & 7;
-        snprintf(buf, sizeof(buf), "%0*ld", (int)(rem + 1 + (x < 0)), (long int)x);
-        size_t len = strlen(buf);
-        s.append(buf, len - rem);
-        if (rem) {
-            s += '.';
-            s.append(buf + len - rem, rem);
+        for (size_t i = sensors; i + 1 < n && series + 1 < HISTORY_MAX_SERIES; i += 3) {
+            historyIndex[series++] = i;
+            historyIndex[series++] = i + 1;
         }
+        for (size_t i = 0; i < sensors && series < HISTORY_MAX_SERIES; ++i)
+            historyIndex[series++] = i;
+        portENTER_CRITICAL(&history_mux);
+        history.reset(series);
+        portEXIT_CRITICAL(&history_mux);
+        historyConfigured = true;
+    }
+    int64_t v[HISTORY_MAX_SERIES];
+    for (size_t i = 0; i < history.series(); ++i) {
+        size_t idx = historyIndex[i];
+        v[i] = idx < n ? statusValues[idx] : 0;
+        historyDecimals[i] = idx < n ? statusDecimals[idx] : 0;
+    }
+    uint32_t now = esp_timer_get_time() / 1000000;
+    portENTER_CRITICAL(&history_mux);
+    history.add(now, v);
+    portEXIT_CRITICAL(&history_mux);
+}
+
+void handleStatus(const uint8_t* data, size_t len) {
+    size_t n = statusPlan.decode(data, len, statusValues, STATUS_MAX_FIELDS);
+    for (size_t i = 0; i < n; ++i) {
+        statusDecimals[i] = statusPlan.decimals(i);
     }
     for (int i = 0; i < max_sensors; i++) {
         if (!config.sensors[i].type) {
             continue;
         }
         auto& ret = dht_ret[i];
-        snprintf(buf, sizeof(buf), ",%d.%d,%d.%d,%d", ret.hum / 10, ret.hum % 10, ret.temp / 10, ret.temp % 10, ret.ret);
-        s += buf;
+        statusValues[n] = ret.hum;
+        statusDecimals[n++] = 1;
+        statusValues[n] = ret.temp;
+        statusDecimals[n++] = 1;
+        statusValues[n] = ret.ret;
+        statusDecimals[n++] = 0;
+    }
+    recordHistory(n);
+    bool changed = n != polledCount;
+    for (size_t i = 0; i < n && !changed; ++i) {
+        int64_t d = statusValues[i] - polledValues[i];
+        changed = (d < 0 ? -d : d) > statusDeadband[i];
     }
-    s += "]";
-    mqtt_publish_bin("esp-data", s.c_str(), s.length());
+    if (changed) {
+        statusChanged = true;
+        std::copy_n(statusValues, n, polledValues);
+        polledCount = n;
+    }
+    portENTER_CRITICAL(&status_mux);
+    bool respond = statusResponsePending;
+    mqtt_response_t response = statusResponse;
+    statusResponsePending = false;
+    portEXIT_CRITICAL(&status_mux);
+    if (respond) {
+        auto& w = formatStatusFull(n);
+        mqtt_publish_response(response, w.c_str(), w.length());
+    }
+    if (config.telemetry_batch) {
+        publishStatusBinary(n);
+        return;
+    }
+    flushTelemetry();
+    uint16_t keyframe = config.keyframe_interval;
+    if (keyframe && intervalsSinceKeyframe && intervalsSinceKeyframe < keyframe && n == publishedCount) {
+        publishStatusDelta(n);
+        ++intervalsSinceKeyframe;
+    } else {
+        publishStatusFull(n);
+        intervalsSinceKeyframe = 1;
+    }
+}
+
+static void handleDatatypes(const uint8_t* data, size_t len) {
+    if (!statusPlan.compile(data, len)) {
+        ESP_LOGW(TAG, "Status format has more than %d fields", STATUS_MAX_FIELDS);
+    }
+    portENTER_CRITICAL(&status_mux);
+    haveDatatypes = len > 0;
+    portEXIT_CRITICAL(&status_mux);
+    if (len)
+        saveStatusFormatCache(data, len);
 }
 
-inline bool checksumOk(const uint8_t* data, size_t len) { return checksum(data, len - 1) == data[len - 1]; }
+static void handleDeviceType(const uint8_t* data, size_t len) {
+    if (len < 6)
+        return;
+    deviceIdentity = (uint32_t)data[2] << 24 | data[3] << 16 | data[4] << 8 | data[5];
+    haveDeviceIdentity = true;
+    TextBuffer<64> w;
+    w.str("device: mfr=").num(data[2]).str(" type=").num(data[3]).str(" hw=").num(data[4]).str(" list=").num(data[5]);
+    logAndPublish("data", w);
+}
+
+static void handleSerial(const uint8_t* data, size_t len) {
+    if (len < 3)
+        return;
+    TextBuffer<32> w;
+    w.str("serial: ").num(data[0] << 16 | data[1] << 8 | data[2]);
+    logAndPublish("data", w);
+}
+
+static void registerReplyHandlers() {
+    itho_reply_register(0xA400, ITHO_REPLY_FLAGS, &handleDatatypes);
+    itho_reply_register(0xA401, ITHO_REPLY_FLAGS, &handleStatus);
+    itho_reply_register(0x90E0, ITHO_REPLY_FLAGS, &handleDeviceType);
+    itho_reply_register(0x90E1, ITHO_REPLY_FLAGS, &handleSerial);
+}
 
 void i2c_slave_callback(const uint8_t* data, size_t len) {
-    std::string s = toHexStr(data, len);
-    if (len > 6 && data[1] == 0x82 && data[2] == 0xA4 && data[3] == 0 && data[4] == 1 && data[5] < len - 5 && checksumOk(data, len)) {
+    itho_reply_dispatch(data, len);
+    if (reportHex || verbose) {
+        // only runs in the I2C slave callback task
+        static TextBuffer<3 * I2C_SLAVE_FRAME_LEN> w;
+        w.clear();
+        w.hex(data, len);
+        if (reportHex) {
+            publish("hex", w);
+        }
+        if (verbose) {
+            printf("Slave: %s\n", w.c_str());
+        }
+    }
+}
+
+// Binary capture records are batched and published when the batch is full, or by sniffBinTimer when it is 1 s old
+static uint8_t sniffBin[1024];
+static size_t sniffBinLen;
+static int64_t sniffBinTime;
+static SemaphoreHandle_t sniffBinLock; // sniffer output task, sniffBinTimer and the b command
+
+// With sniffBinLock held
+static void flushSniffBin() {
+    if (sniffBinLen)
+        mqtt_publish_bin("sniff-bin", (const char*)sniffBin, sniffBinLen);
+    sniffBinLen = 0;
+}
+
+static void publishSniffBin(const sniffer_frame_t& frame) {
+    uint8_t rec[I2C_SNIFFER_RECORD_MAX];
+    size_t len = i2c_sniffer_encode(frame, rec, sizeof(rec));
+    xSemaphoreTake(sniffBinLock, portMAX_DELAY);
+    if (sniffBinLen + len > sizeof(sniffBin))
+        flushSniffBin();
+    if (!sniffBinLen)
+        sniffBinTime = esp_timer_get_time();
+    memcpy(sniffBin + sniffBinLen, rec, len);
+    sniffBinLen += len;
+    xSemaphoreGive(sniffBinLock);
+}
+
+// Runs every 250 ms, so a partial batch is also sent when the bus goes quiet
+static void sniffBinTimer(void*) {
+    xSemaphoreTake(sniffBinLock, portMAX_DELAY);
+    if (sniffBinLen && esp_timer_get_time() - sniffBinTime >= 1000000)
+        flushSniffBin();
+    xSemaphoreGive(sniffBinLock);
+}
+
+static void initSniffBin() {
+    sniffBinLock = xSemaphoreCreateMutex();
+    esp_timer_create_args_t args = {};
+    args.callback = &sniffBinTimer;
+    args.name = "sniff-bin";
+    esp_timer_handle_t timer;
+    esp_timer_create(&args, &timer);
+    esp_timer_start_periodic(timer, 250000);
+}
+
+static void i2c_sniffer_callback(const sniffer_frame_t& frame) {
+    if (reportSniffBin) {
+        publishSniffBin(frame);
+        return;
+    }
+    char buf[I2C_SNIFFER_FRAME_LEN * 3 + 64];
+    size_t len = i2c_sniffer_format(frame, buf, sizeof(buf));
+    printf("%s\n", buf);
+    if (reportSniff) {
+        mqtt_publish_bin("sniff", buf, len);
+    }
+}
+
+static void i2c_sniffer_timing_callback(const i2c_sniffer_timing_t& timing) {
+    char buf[512];
+    size_t len = i2c_sniffer_format_timing(timing, buf, sizeof(buf));
+    printf("%s\n", buf);
+    mqtt_publish_state("timing", buf, len);
+}
+
+// Command handlers, see the command table below
+
+static bool cmdHighHumThreshold(const CommandArgs& args) {
+    if (args.count) {
+        int hum = args.ints[0];
+        if (hum < 100 || hum > 1000) {
+            TextBuffer<48> w;
+            w.str("invalid parameter value ").num(hum);
+            ESP_LOGE(TAG, "%s", w.c_str());
+            publish("dht", w);
+            return false;
+        }
+        config.high_hum_threshold = Config::normalize_high_hum_threshold(hum);
+        if (!config.Write()) {
+            ESP_LOGE(TAG, "Config write failed");
+        }
+    }
+    TextBuffer<32> w;
+    w.str("high_hum_threshold=").fixed(config.high_hum_threshold, 1);
+    logAndPublish("dht", w);
+    return true;
+}
+
+static bool cmdAnalyze(const CommandArgs& args) {
+    i2c_sniffer_analyze(args.count ? std::max(args.ints[0], 0) : 0);
+    TextBuffer<32> w;
+    w.str("analyze=").num(i2c_sniffer_analyze_period());
+    logAndPublish("data", w);
+    return true;
+}
+
+static bool cmdPoll(const CommandArgs& args) {
+    if (args.count == 1)
+        return false;
+    if (args.count == 2) {
+        config.poll_min = std::clamp(args.ints[0], 0, 0xFFFF);
+        config.poll_max = std::clamp(args.ints[1], 0, 0xFFFF);
+        config.normalize_poll();
+        if (!config.Write()) {
+            ESP_LOGE(TAG, "Config write failed");
+        }
+        pollSoon();
+    }
+    TextBuffer<128> w;
+    writePollStats(w);
+    logAndPublish("data", w);
+    return true;
+}
+
+static bool cmdTelemetry(const CommandArgs& args) {
+    if (args.count) {
+        config.telemetry_batch = std::clamp(args.ints[0], 0, 0xFFFF);
+        if (!config.Write()) {
+            ESP_LOGE(TAG, "Config write failed");
+        }
+    }
+    TextBuffer<128> w;
+    writeTelemetryStats(w);
+    logAndPublish("data", w);
+    return true;
+}
+
+static bool cmdDevice(const CommandArgs& args) {
+    esp_err_t rc = itho_query(0x90E0, nullptr, 0, ITHO_QUERY_TIMEOUT_MS, ITHO_QUERY_RETRIES, nullptr, nullptr);
+    esp_err_t rc2 = itho_query(0x90E1, nullptr, 0, ITHO_QUERY_TIMEOUT_MS, ITHO_QUERY_RETRIES, nullptr, nullptr);
+    return rc == ESP_OK && rc2 == ESP_OK;
+}
+
+// With MQTT 5 the next status is also sent to the response topic of the request
+static bool cmdStatus(const CommandArgs& args) {
+    if (args.response) {
         portENTER_CRITICAL(&status_mux);
-        datatypes.assign((const char*)data + 6, data[5]);
+        statusResponse = *args.response;
+        statusResponsePending = true;
         portEXIT_CRITICAL(&status_mux);
     }
-    if (len > 6 && data[1] == 0x82 && data[2] == 0xa4 && data[3] == 1 && data[4] == 1 && data[5] < len - 5 && checksumOk(data, len)) {
-        handleStatus(data + 6, len - 7);
+    return xTaskCreate(requestStatusTask, "requestStatusTask", 4096, NULL, 6, NULL) == pdPASS;
+}
+
+static bool cmdPing(const CommandArgs& args) {
+    if (args.response)
+        mqtt_publish_response(*args.response, "pong", 4);
+    else
+        mqtt_publish("data", "pong");
+    return true;
+}
+
+static bool cmdConfig(const CommandArgs& args) {
+    if (config.Reconfigure()) {
+        i2c_sniffer_enable();
+        printf("Sniffer is ON.\n"
+               "Press any key on the RFT device, watching for a message that looks like:\n"
+               "82 60 C1 01 01 11 .. .. .. .. xx xx xx xx .. .. .. .. .. .. .. .. .. ..\n"
+               "The RFT ID will be the values xx xx xx xx.\n"
+               "Write those down, then turn off the sniffer with the 's' command.\n");
+    }
+    return true;
+}
+
+static bool cmdHelp(const CommandArgs& args);
+
+// Commands are matched by their exact name; hex bytes that are not a command are sent to the bus
+static constexpr Command commands[] = {
+    {"set1", ArgType::NONE, 0, 0, CMD_ANY, [](const CommandArgs&) { return setLevel(1); }, "set ventilation level to low"},
+    {"set2", ArgType::NONE, 0, 0, CMD_ANY, [](const CommandArgs&) { return setLevel(2); }, "set ventilation level to medium"},
+    {"set3", ArgType::NONE, 0, 0, CMD_ANY, [](const CommandArgs&) { return setLevel(3); }, "set ventilation level to high for 30 min"},
+    {"status", ArgType::NONE, 0, 0, CMD_ANY, cmdStatus, "request device status"},
+    {"ping", ArgType::NONE, 0, 0, CMD_ANY, cmdPing, "request pong"},
+    {"hum", ArgType::NONE, 0, 0, CMD_ANY, [](const CommandArgs&) { publishHumidity(); return true; }, "publish humidity sensor values"},
+    {"high_hum_threshold", ArgType::INT, 0, 1, CMD_ANY, cmdHighHumThreshold, "[N] get/set high humidity threshold in 0.1 %"},
+    {"stats", ArgType::NONE, 0, 0, CMD_ANY, [](const CommandArgs&) { publishStats(); return true; }, "publish counters"},
+    {"analyze", ArgType::INT, 0, 1, CMD_ANY, cmdAnalyze, "N publish bus timing every N s, 0 = off"},
+    {"filter", ArgType::TEXT, 0, 5, CMD_ANY,
+     [](const CommandArgs& a) { return processFilterCommand(a.text, a.text_len); },
+     "[clear|default pass|drop|pass|drop ADDR [CODE [FLAGS]]] sniffer filter"},
+    {"poll", ArgType::INT, 0, 2, CMD_ANY, cmdPoll, "[MIN MAX] status poll interval bounds in s"},
+    {"telemetry", ArgType::INT, 0, 1, CMD_ANY, cmdTelemetry, "[N] binary telemetry batch size, 0 = JSON"},
+    {"history", ArgType::TEXT, 0, 1 + HISTORY_MAX_SERIES, CMD_ANY,
+     [](const CommandArgs& a) { return processHistoryCommand(a.text, a.text_len); },
+     "[track [INDEX ...]|5s|1m|1h [SECONDS]] on-device history"},
+    {"deadband", ArgType::TEXT, 0, 2, CMD_ANY,
+     [](const CommandArgs& a) { return processDeadbandCommand(a.text, a.text_len); },
+     "[clear|keyframe N|INDEX|* VALUE] delta publishing"},
+    {"device", ArgType::NONE, 0, 0, CMD_ANY, cmdDevice, "query device type and serial number"},
+    {"help", ArgType::NONE, 0, 0, CMD_ANY, cmdHelp, "list commands"},
+    {"config", ArgType::NONE, 0, 0, CMD_CONSOLE, cmdConfig, "configure Wi-Fi, MQTT and sensors"},
+    {"r", ArgType::NONE, 0, 0, CMD_CONSOLE,
+     [](const CommandArgs&) {
+         printf("Restarting\n");
+         vTaskDelay(configTICK_RATE_HZ / 4);
+         esp_restart();
+         return true;
+     },
+     "restart"},
+    {"p", ArgType::NONE, 0, 0, CMD_CONSOLE, [](const CommandArgs&) { i2c_sniffer_pullup(false); printf("Pullup OFF\n"); return true; }, "pullup off"},
+    {"P", ArgType::NONE, 0, 0, CMD_CONSOLE, [](const CommandArgs&) { i2c_sniffer_pullup(true); printf("Pullup ON\n"); return true; }, "pullup on"},
+    {"s", ArgType::NONE, 0, 0, CMD_CONSOLE, [](const CommandArgs&) { i2c_sniffer_disable(); printf("Sniffer OFF\n"); return true; }, "sniffer off"},
+    {"S", ArgType::NONE, 0, 0, CMD_CONSOLE, [](const CommandArgs&) { i2c_sniffer_enable(); printf("Sniffer ON\n"); return true; }, "sniffer on"},
+    {"h", ArgType::NONE, 0, 0, CMD_CONSOLE,
+     [](const CommandArgs&) {
+         reportHex = false;
+         printf("hex reporting OFF\n");
+         return true;
+     },
+     "hex reporting off"},
+    {"H", ArgType::NONE, 0, 0, CMD_CONSOLE,
+     [](const CommandArgs&) {
+         reportHex = true;
+         printf("hex reporting ON\n");
+         return true;
+     },
+     "hex reporting on"},
+    {"m", ArgType::NONE, 0, 0, CMD_CONSOLE,
+     [](const CommandArgs&) {
+         reportSniff = false;
+         printf("sniff reporting OFF\n");
+         return true;
+     },
+     "sniffer MQTT reporting off"},
+    {"M", ArgType::NONE, 0, 0, CMD_CONSOLE,
+     [](const CommandArgs&) {
+         reportSniff = true;
+         printf("sniff reporting ON\n");
+         return true;
+     },
+     "sniffer MQTT reporting on"},
+    {"b", ArgType::NONE, 0, 0, CMD_CONSOLE,
+     [](const CommandArgs&) {
+         reportSniffBin = false;
+         xSemaphoreTake(sniffBinLock, portMAX_DELAY);
+         flushSniffBin();
+         xSemaphoreGive(sniffBinLock);
+         printf("sniff-bin reporting OFF\n");
+         return true;
+     },
+     "sniffer binary capture off"},
+    {"B", ArgType::NONE, 0, 0, CMD_CONSOLE,
+     [](const CommandArgs&) {
+         reportSniffBin = true;
+         printf("sniff-bin reporting ON\n");
+         return true;
+     },
+     "sniffer binary capture on"},
+};
+static constexpr CommandTable commandTable(commands);
+
+static bool cmdHelp(const CommandArgs& args) {
+    static TextBuffer<2048> w;
+    w.clear();
+    for (size_t i = 0; i < commandTable.size(); ++i) {
+        const Command& c = commandTable[i];
+        if (c.sources & args.source)
+            w.str(c.name).ch(' ').str(c.help).ch('\n');
+    }
+    w.str("HEX BYTES send to the bus");
+    if (args.source == CMD_CONSOLE)
+        printf("%s\n", w.c_str());
+    else
+        publish("data", w);
+    return true;
+}
+
+// Returns false for unknown commands, invalid arguments and failures; response: where an MQTT 5 request wants the reply
+static bool processCommand(const char* data, int data_len, uint8_t source = CMD_MQTT, const mqtt_response_t* response = nullptr) {
+    CommandArgs args;
+    args.response = response;
+    CommandResult rc = commandTable.run(data, data_len, source, args);
+    if (rc == CommandResult::UNKNOWN && data_len && isHex(data[0])) {
+        if (parseCommandArgs(ArgType::HEX, 1, COMMAND_MAX_BYTES, data, data_len, args))
+            rc = sendBytes(args.bytes, args.count) ? CommandResult::OK : CommandResult::FAILED;
+        else
+            rc = CommandResult::BAD_ARGS;
+    }
+    if (rc == CommandResult::UNKNOWN)
+        ESP_LOGE(TAG, "Unknown command '%.*s'", data_len, data);
+    else if (rc == CommandResult::NOT_AVAILABLE)
+        ESP_LOGE(TAG, "'%.*s' is only available on the console", data_len, data);
+    else if (rc == CommandResult::BAD_ARGS)
+        ESP_LOGE(TAG, "Invalid arguments: '%.*s'", data_len, data);
+    return rc == CommandResult::OK;
+}
+
+static void processConsoleCommand() { processCommand(cmd, strlen(cmd), CMD_CONSOLE); }
+
+// Command batches: the commands of a message are started in order without waiting for the bus. Sends and queries
+// complete asynchronously (pipelined), then one result with the status and duration of every command is published.
+#define BATCH_TIMEOUT_MS 5000
+#define BATCH_START      1 // task notification bits
+#define BATCH_DONE       2
+
+static struct {
+    esp_err_t rc;
+    uint8_t pending; // sends and queries still running
+    int64_t start, end;
+} batchResults[BATCH_MAX_COMMANDS];
+static CommandBatch batch;
+static mqtt_response_t batchResponse;
+static bool batchRespond;
+static bool batchBusy;
+static uint32_t batchGeneration; // completions of a timed out batch are ignored
+static TaskHandle_t batchTask;
+static portMUX_TYPE batch_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void batchCompleted(uintptr_t tag, esp_err_t rc) {
+    portENTER_CRITICAL(&batch_mux);
+    if (tag >> 8 == batchGeneration) {
+        auto& r = batchResults[tag & 0xFF];
+        if (rc && !r.rc)
+            r.rc = rc;
+        if (r.pending && !--r.pending)
+            r.end = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&batch_mux);
+    xTaskNotify(batchTask, BATCH_DONE, eSetBits);
+}
+
+static void batchSendDone(esp_err_t rc, void* arg) { batchCompleted((uintptr_t)arg, rc); }
+
+static void batchQueryDone(esp_err_t rc, const uint8_t* payload, size_t len, void* arg) { batchCompleted((uintptr_t)arg, rc); }
+
+// Waits while the code is already in flight (e.g. a status poll) or all query slots are taken
+static void batchQuery(uint16_t code, uintptr_t tag) {
+    esp_err_t rc;
+    int64_t until = esp_timer_get_time() + ITHO_QUERY_TIMEOUT_MS * (ITHO_QUERY_RETRIES + 1) * 1000LL;
+    while ((rc = itho_query(code, nullptr, 0, ITHO_QUERY_TIMEOUT_MS, ITHO_QUERY_RETRIES, &batchQueryDone, (void*)tag)) &&
+           (rc == ESP_ERR_INVALID_STATE || rc == ESP_ERR_NO_MEM) && esp_timer_get_time() < until) {
+        vTaskDelay(1);
+    }
+    if (rc)
+        batchCompleted(tag, rc);
+}
+
+static void startBatchCommand(size_t i) {
+    const char* cmd = batch.command(i);
+    size_t len = batch.length(i);
+    uintptr_t tag = batchGeneration << 8 | i;
+    auto& r = batchResults[i];
+    auto setPending = [&](uint8_t n) {
+        portENTER_CRITICAL(&batch_mux);
+        r.pending = n;
+        portEXIT_CRITICAL(&batch_mux);
+    };
+    portENTER_CRITICAL(&status_mux);
+    bool compiled = haveDatatypes;
+    portEXIT_CRITICAL(&status_mux);
+    r.rc = ESP_OK;
+    r.start = esp_timer_get_time();
+    if (len == 4 && memcmp(cmd, "set", 3) == 0 && cmd[3] >= '1' && cmd[3] <= '3') {
+        setPending(1);
+        if (!setLevel(cmd[3] - '0', &batchSendDone, (void*)tag))
+            batchCompleted(tag, ESP_FAIL);
+    } else if (strcmp(cmd, "device") == 0) {
+        setPending(2);
+        batchQuery(0x90E0, tag);
+        batchQuery(0x90E1, tag);
+    } else if (strcmp(cmd, "status") == 0 && compiled) {
+        setPending(1);
+        batchQuery(0xA401, tag);
+    } else if (strcmp(cmd, "status") == 0) {
+        // the format has to be fetched first
+        r.rc = requestStatus();
+    } else if (strcmp(cmd, "ping") == 0) {
+    } else if (isHex(cmd[0]) && !commandTable.find(cmd, strcspn(cmd, " "))) {
+        CommandArgs args;
+        setPending(1);
+        if (!parseCommandArgs(ArgType::HEX, 1, COMMAND_MAX_BYTES, cmd, len, args))
+            batchCompleted(tag, ESP_ERR_INVALID_ARG);
+        else if (!sendBytes(args.bytes, args.count, &batchSendDone, (void*)tag))
+            batchCompleted(tag, ESP_FAIL);
+    } else if (!processCommand(cmd, len)) {
+        r.rc = ESP_ERR_NOT_SUPPORTED;
+    }
+    portENTER_CRITICAL(&batch_mux);
+    if (!r.pending)
+        r.end = esp_timer_get_time();
+    portEXIT_CRITICAL(&batch_mux);
+}
+
+// {"batch":[{"cmd":"device","rc":"ESP_OK","ms":12.3},...],"ms":45.6}
+static void publishBatchResult(int64_t start, int64_t end) {
+    static TextBuffer<64 + BATCH_MAX_TEXT + 64 * BATCH_MAX_COMMANDS> w;
+    w.clear();
+    w.str("{\"batch\":[");
+    for (size_t i = 0; i < batch.size(); ++i) {
+        auto& r = batchResults[i];
+        w.str(i ? ",{\"cmd\":\"" : "{\"cmd\":\"");
+        for (const char* c = batch.command(i); *c; ++c) {
+            if (*c == '"' || *c == '\\')
+                w.ch('\\');
+            w.ch(*c < ' ' ? ' ' : *c);
+        }
+        w.str("\",\"rc\":\"").str(esp_err_to_name(r.rc)).str("\",\"ms\":").fixed((r.end - r.start) / 100, 1).ch('}');
+    }
+    w.str("],\"ms\":").fixed((end - start) / 100, 1).ch('}');
+    if (w.overflow())
+        ESP_LOGW(TAG, "Batch result truncated");
+    if (batchRespond)
+        mqtt_publish_response(batchResponse, w.c_str(), w.length());
+    else
+        publish("data", w);
+}
+
+static void runBatch() {
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < batch.size(); ++i)
+        startBatchCommand(i);
+    TickType_t until = xTaskGetTickCount() + pdMS_TO_TICKS(BATCH_TIMEOUT_MS);
+    for (;;) {
+        bool done = true;
+        portENTER_CRITICAL(&batch_mux);
+        for (size_t i = 0; i < batch.size(); ++i)
+            done = done && !batchResults[i].pending;
+        portEXIT_CRITICAL(&batch_mux);
+        TickType_t now = xTaskGetTickCount();
+        if (done || (int32_t)(until - now) <= 0 || !xTaskNotifyWait(0, BATCH_DONE, nullptr, until - now))
+            break;
     }
-    if (reportHex) {
-        mqtt_publish_bin("esp-data-hex", s.c_str(), s.length());
+    portENTER_CRITICAL(&batch_mux);
+    ++batchGeneration;
+    int64_t end = esp_timer_get_time();
+    for (size_t i = 0; i < batch.size(); ++i) {
+        auto& r = batchResults[i];
+        if (r.pending) {
+            r.pending = 0;
+            r.rc = ESP_ERR_TIMEOUT;
+            r.end = end;
+        }
     }
-    if (verbose) {
-        printf("Slave: %s\n", s.c_str());
+    portEXIT_CRITICAL(&batch_mux);
+    publishBatchResult(start, end);
+}
+
+static void batchLoopTask(void* arg) {
+    for (;;) {
+        uint32_t bits = 0;
+        xTaskNotifyWait(0, BATCH_START | BATCH_DONE, &bits, portMAX_DELAY);
+        if (!(bits & BATCH_START))
+            continue;
+        runBatch();
+        portENTER_CRITICAL(&batch_mux);
+        batchBusy = false;
+        portEXIT_CRITICAL(&batch_mux);
     }
 }
 
+// Runs the batch in the batch task, a batch that arrives while one is running is rejected
+static void startBatch(const char* data, int data_len) {
+    portENTER_CRITICAL(&batch_mux);
+    bool busy = batchBusy;
+    batchBusy = true;
+    portEXIT_CRITICAL(&batch_mux);
+    const char* error = busy ? "batch: busy" : !batch.parse(data, data_len) ? "batch: malformed or too long" : nullptr;
+    if (error) {
+        ESP_LOGW(TAG, "%s", error);
+        mqtt_publish("data", error);
+        if (!busy) {
+            portENTER_CRITICAL(&batch_mux);
+            batchBusy = false;
+            portEXIT_CRITICAL(&batch_mux);
+        }
+        return;
+    }
+    batchRespond = mqtt_request_response(batchResponse);
+    xTaskNotify(batchTask, BATCH_START, eSetBits);
+}
+
 static void processMqttCommand(const char* data, int data_len) {
-    if (strncmp("status", data, data_len) == 0) {
-        xTaskCreate(requestStatusTask, "requestStatusTask", 4096, NULL, 6, NULL);
-    } else if (strncmp("ping", data, data_len) == 0) {
-        mqtt_publish("esp-data", "pong");
-    } else {
-        processCommand(data, data_len);
+    if (CommandBatch::isBatch(data, data_len))
+        startBatch(data, data_len);
+    else {
+        size_t len = data_len;
+        CommandBatch::trim(data, len); // "status\n" from mosquitto_pub -s
+        // only valid in the subscribe callback
+        mqtt_response_t response;
+        bool respond = mqtt_request_response(response);
+        processCommand(data, len, CMD_MQTT, respond ? &response : nullptr);
     }
 }
 
+// cmd: the payload is the command, cmd/NAME: NAME is the command and the payload its arguments
 static void mqtt_message_callback(const char* topic, int topic_len, const char* data, int data_len) {
-    processMqttCommand(data, data_len);
-    // ESP_LOGD(TAG, "mqtt_callback '%.*s' '%.*s'", topic_len, topic, data_len, data);
+    if (topic_len <= 4) {
+        processMqttCommand(data, data_len);
+        return;
+    }
+    TextBuffer<256> w;
+    w.str(topic + 4, topic_len - 4);
+    if (data_len)
+        w.ch(' ').str(data, data_len);
+    if (w.overflow()) {
+        ESP_LOGW(TAG, "Command on %.*s too long", topic_len, topic);
+        return;
+    }
+    processMqttCommand(w.c_str(), w.length());
 }
 
-static void mqtt_connect_callback() { mqtt_subscribe("esp", mqtt_message_callback); }
+static void mqtt_connect_callback() { mqtt_subscribe("cmd/#", mqtt_message_callback); }
 
 static void dht_task(void* arg) {
     int id = (int)arg;
-    DHT dht(("DHT" + std::to_string(id + 1)).c_str(), (gpio_num_t)config.sensors[id].sda);
-    int errors = 1;
-    auto& ret = dht_ret[id];
-    while (1) {
-        vTaskDelay(5 * configTICK_RATE_HZ); // wait at least 2 sec before reading again
-        ret.ret = dht.readDHT();
-        if (!dht.errorHandler(ret.ret)) {
-            if (errors && ++errors > 3) {
-                ESP_LOGI(TAG, "Stopping DHT[%d] task", id + 1);
-                break;
+    // scoped so the RMT channel is released when the task stops
+    {
+        DHT dht(("DHT" + std::to_string(id + 1)).c_str(), (gpio_num_t)config.sensors[id].sda);
+        int errors = 1;
+        auto& ret = dht_ret[id];
+        while (1) {
+            vTaskDelay(5 * configTICK_RATE_HZ); // wait at least 2 sec before reading again
+            ret.ret = dht.readDHT();
+            if (!dht.errorHandler(ret.ret)) {
+                if (errors && ++errors > 3) {
+                    ESP_LOGI(TAG, "Stopping DHT[%d] task", id + 1);
+                    break;
+                }
+                continue;
             }
-            continue;
+            errors = 0;
+            ret.hum = dht.getHumidity();
+            ret.temp = dht.getTemperature();
+            ESP_LOGI(TAG, "DHT[%d] Humidity %d.%d, Temp %d.%d", id + 1, ret.hum / 10, ret.hum % 10, ret.temp / 10, ret.temp % 10);
+            handleHumidity();
         }
-        errors = 0;
-        ret.hum = dht.getHumidity();
-        ret.temp = dht.getTemperature();
-        ESP_LOGI(TAG, "DHT[%d] Humidity %d.%d, Temp %d.%d", id + 1, ret.hum / 10, ret.hum % 10, ret.temp / 10, ret.temp % 10);
-        handleHumidity();
     }
     vTaskDelete(nullptr);
 }
@@ -372,10 +1424,17 @@ extern "C" void app_main() {
     // esp_log_level_set("SHT4x", ESP_LOG_DEBUG);
     nvs.Init();
     config.Read();
+    parseDeadbands(config.deadbands.c_str());
+    loadStatusFormatCache();
+    parseHistorySeries(config.history_series.c_str());
     initRFTKey(config.rftKey);
-    i2c_sniffer_init(false);
+    initSniffBin();
+    i2c_sniffer_init(false, &i2c_sniffer_callback, &i2c_sniffer_timing_callback);
     i2c_master_init();
+    itho_query_init();
+    registerReplyHandlers();
     i2c_slave_init(&i2c_slave_callback);
+    xTaskCreatePinnedToCore(batchLoopTask, "batchTask", 4096, NULL, 6, &batchTask, 1);
     wifi_init();
     mqtt_init();
     mqtt_on_connect(&mqtt_connect_callback);
@@ -389,7 +1448,7 @@ extern "C" void app_main() {
                 break;
         }
     }
-    xTaskCreatePinnedToCore(requestStatusLoopTask, "statusLoopTask", 4096, NULL, 8, NULL, 1);
+    xTaskCreatePinnedToCore(requestStatusLoopTask, "statusLoopTask", 4096, NULL, 8, &statusLoopTask, 1);
 
     printf("Press Enter to start console\n");
     while (1) {
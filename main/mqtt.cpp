@@ -1,4 +1,5 @@
 #include "mqtt.h"
+#include "topic_alias.h"
 #include "wifi.h"
 #include <esp32/rom/ets_sys.h>
 #include <esp_event.h>
@@ -9,10 +10,12 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <mbedtls/ssl.h>
 #include <mqtt_client.h>
 #include <nvs_flash.h>
+#include <algorithm>
 #include <string.h>
 #include <string>
 
@@ -21,16 +24,120 @@ mqtt_config_t mqtt_config;
 static esp_mqtt_client_handle_t mqttClient;
 static EventGroupHandle_t mqtt_event_group;
 const int MQTT_CONNECTED_BIT = BIT1;
-static mqtt_callback_t mqttCallback;
 #define MAX_MQTT_CALLBACKS 2
 static mqtt_connect_callback_t mqtt_connect_callbacks[MAX_MQTT_CALLBACKS];
 
+// Outbound queue, state message times are in us
+static PublishQueue queue;
+static mqtt_publish_stats_t publish_stats;
+static SemaphoreHandle_t queue_lock;
+static TaskHandle_t publish_task;
+
+// Topic names are resolved against the namespace prefix, itho/<id>/ or esp-data- in legacy mode
+static char topic_prefix[MQTT_MAX_TOPIC + 1];
+static size_t topic_prefix_len;
+
+// Inbound router: open addressing on the hash of the route name
+struct route_t {
+    char name[MQTT_MAX_ROUTE + 1];
+    uint8_t len;
+    bool wildcard; // also matches name/...
+    mqtt_callback_t callback;
+};
+
+static route_t routes[MQTT_ROUTES];
+
+// Response topic of the message being routed, only valid during the callback
+static mqtt_response_t request_response;
+static bool have_request_response;
+
+// Topic aliases of the state topics, only used by the publish task; connection counts connects, the aliases have to be
+// sent again on each
+#ifdef CONFIG_MQTT_PROTOCOL_5
+static TopicAliases aliases;
+#endif
+static uint32_t connection;
+
+static void start_replay();
+
+static uint32_t route_hash(const char* s, size_t len) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+static route_t* route_find(const char* name, size_t len, bool add) {
+    for (uint32_t i = route_hash(name, len), n = 0; n < MQTT_ROUTES; ++i, ++n) {
+        route_t& r = routes[i & (MQTT_ROUTES - 1)];
+        if (!r.callback)
+            return add ? &r : nullptr;
+        if (r.len == len && memcmp(r.name, name, len) == 0)
+            return &r;
+    }
+    return nullptr;
+}
+
+// topic relative to the namespace, or null if the topic is outside of it
+static const char* relative_topic(const char* topic, int& len) {
+    if (mqtt_config.legacy_topics) {
+        if (len != 3 || memcmp(topic, "esp", 3) != 0)
+            return nullptr;
+        len = 3;
+        return "cmd";
+    }
+    if ((size_t)len <= topic_prefix_len || memcmp(topic, topic_prefix, topic_prefix_len) != 0)
+        return nullptr;
+    len -= topic_prefix_len;
+    return topic + topic_prefix_len;
+}
+
+static void route(const char* topic, int topic_len, const char* data, int data_len) {
+    int len = topic_len;
+    const char* name = relative_topic(topic, len);
+    if (!name) {
+        ESP_LOGW(TAG, "No route for '%.*s'", topic_len, topic);
+        return;
+    }
+    const char* slash = (const char*)memchr(name, '/', len);
+    size_t level = slash ? slash - name : len;
+    route_t* r = route_find(name, level, false);
+    if (!r || (slash && !r->wildcard)) {
+        ESP_LOGW(TAG, "No route for '%.*s'", topic_len, topic);
+        return;
+    }
+    r->callback(name, len, data, data_len);
+}
+
+// Full topic of a name, empty if it does not fit
+static void full_topic(const char* name, char (&buf)[MQTT_MAX_TOPIC + 1]) {
+    size_t len = strlen(name);
+    if (mqtt_config.legacy_topics) {
+        if (strcmp(name, "cmd") == 0 || strncmp(name, "cmd/", 4) == 0) {
+            strcpy(buf, "esp");
+            return;
+        }
+        if (strcmp(name, "data") == 0 || strcmp(name, "status") == 0) {
+            strcpy(buf, "esp-data");
+            return;
+        }
+    }
+    if (topic_prefix_len + len > MQTT_MAX_TOPIC) {
+        buf[0] = 0;
+        return;
+    }
+    memcpy(buf, topic_prefix, topic_prefix_len);
+    memcpy(buf + topic_prefix_len, name, len + 1);
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
     // int msg_id;
     esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:
+        ++connection;
         xEventGroupSetBits(mqtt_event_group, MQTT_CONNECTED_BIT);
+        start_replay();
         for (int i = 0; i < MAX_MQTT_CALLBACKS; ++i) {
             if (!mqtt_connect_callbacks[i])
                 break;
@@ -54,10 +161,22 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     case MQTT_EVENT_UNSUBSCRIBED:
         break;
     case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "Message received: '%.*s'", event->data_len, event->data);
-        if (mqttCallback) {
-            mqttCallback(event->topic, event->topic_len, event->data, event->data_len);
+        ESP_LOGI(TAG, "Message received on '%.*s': '%.*s'", event->topic_len, event->topic, event->data_len, event->data);
+        have_request_response = false;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+        if (event->property && event->property->response_topic && event->property->response_topic_len <= MQTT_MAX_TOPIC &&
+            event->property->correlation_data_len <= MQTT5_MAX_CORRELATION) {
+            auto* p = event->property;
+            memcpy(request_response.topic, p->response_topic, p->response_topic_len);
+            request_response.topic[p->response_topic_len] = 0;
+            if (p->correlation_data_len)
+                memcpy(request_response.correlation, p->correlation_data, p->correlation_data_len);
+            request_response.correlation_len = p->correlation_data_len;
+            have_request_response = true;
         }
+#endif
+        route(event->topic, event->topic_len, event->data, event->data_len);
+        have_request_response = false;
         // HandleMessage(String(event->data, event->data_len));
         // printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
         // printf("DATA=%.*s\r\n", event->data_len, event->data);
@@ -97,32 +216,195 @@ static void mqtt_init_task(void* pvParameter) {
     vTaskDelete(NULL);
 }
 
+static void update_high_water() {
+    publish_stats.queued = queue.bytes();
+    if (publish_stats.queued > publish_stats.high_water)
+        publish_stats.high_water = publish_stats.queued;
+}
+
+static void start_replay() {
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    uint32_t n = queue.count();
+    publish_stats.replay_total = n;
+    publish_stats.replay_done = 0;
+    xSemaphoreGive(queue_lock);
+    if (n)
+        ESP_LOGI(TAG, "Connected, sending %u queued messages", (unsigned)n);
+    xTaskNotifyGive(publish_task);
+}
+
+// Until mqtt_init publishing is a no-op; after that messages are queued even before the first connection
 int mqtt_publish(const char* topic, const char* data) {
-    if (!mqttClient)
+    if (!publish_task)
         return 0;
     return mqtt_publish_bin(topic, data, strlen(data));
 }
 
-int mqtt_publish_bin(const char* topic, const char* data, int len) {
-    if (!mqttClient)
+static int enqueue(const char* topic, const uint8_t* correlation, size_t correlation_len, const char* data, int len) {
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    int rc = queue.push(topic, data, len, correlation, correlation_len) ? 0 : -1;
+    update_high_water();
+    xSemaphoreGive(queue_lock);
+    if (rc == 0)
+        xTaskNotifyGive(publish_task);
+    return rc;
+}
+
+int mqtt_publish_bin(const char* name, const char* data, int len) {
+    if (!publish_task)
         return 0;
-    int msg_id = esp_mqtt_client_publish(mqttClient, topic, data, len, mqtt_config.pub_qos, 0);
-    ESP_LOGD(TAG, "publish to %s: msg_id=%d", topic, msg_id); // msg_id > 0 only when QoS > 0
-    return msg_id;
+    char topic[MQTT_MAX_TOPIC + 1];
+    full_topic(name, topic);
+    return enqueue(topic, nullptr, 0, data, len);
+}
+
+bool mqtt_request_response(mqtt_response_t& out) {
+    if (have_request_response)
+        out = request_response;
+    return have_request_response;
+}
+
+int mqtt_publish_response(const mqtt_response_t& to, const char* data, int len) {
+    if (!publish_task)
+        return 0;
+    return enqueue(to.topic, to.correlation, to.correlation_len, data, len);
+}
+
+int mqtt_publish_state(const char* name, const char* data, int len, const char* supersedes) {
+    if (!publish_task)
+        return 0;
+    char topic[MQTT_MAX_TOPIC + 1], superseded[MQTT_MAX_TOPIC + 1];
+    full_topic(name, topic);
+    if (supersedes)
+        full_topic(supersedes, superseded);
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    int rc = queue.push_state(topic, data, len, esp_timer_get_time(), supersedes ? superseded : nullptr) ? 0 : -1;
+    update_high_water();
+    xSemaphoreGive(queue_lock);
+    if (rc == 0)
+        xTaskNotifyGive(publish_task);
+    return rc;
 }
 
-esp_err_t mqtt_subscribe(const char* topic, mqtt_callback_t callback) {
+mqtt_publish_stats_t mqtt_publish_stats() {
+    xSemaphoreTake(queue_lock, portMAX_DELAY);
+    mqtt_publish_stats_t st = publish_stats;
+    const auto& q = queue.stats();
+    st.dropped += q.dropped;
+    st.evicted = q.evicted;
+    st.coalesced = q.coalesced;
+    st.superseded = q.superseded;
+    xSemaphoreGive(queue_lock);
+    return st;
+}
+
+// State messages are published with a topic alias: a few topics, sent over and over. Only with QoS 0, the outbox could
+// resend a QoS 1/2 message without its topic after a reconnect, when the alias is no longer known to the broker
+static int publish(const char* topic, const char* data, int len, const uint8_t* correlation, size_t correlation_len,
+                   uint32_t expiry, bool state) {
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (mqtt_config.mqtt5) {
+        static uint32_t aliases_connection;
+        if (aliases_connection != connection) {
+            aliases_connection = connection;
+            aliases.connected();
+        }
+        esp_mqtt5_publish_property_config_t property = {};
+        property.message_expiry_interval = expiry;
+        property.correlation_data = (const char*)correlation;
+        property.correlation_data_len = correlation_len;
+        bool send_topic = true;
+        if (state && !mqtt_config.pub_qos)
+            property.topic_alias = aliases.get(topic, send_topic);
+        // esp-mqtt has no getter for the Topic Alias Maximum of the CONNACK, but refuses an alias above it
+        if (esp_mqtt5_client_set_publish_property(mqttClient, &property) != ESP_OK && property.topic_alias) {
+            ESP_LOGW(TAG, "Broker allows %u topic aliases", property.topic_alias - 1);
+            aliases.rejected(property.topic_alias);
+            property.topic_alias = 0;
+            send_topic = true;
+            esp_mqtt5_client_set_publish_property(mqttClient, &property);
+        }
+        return esp_mqtt_client_publish(mqttClient, send_topic ? topic : "", data, len, mqtt_config.pub_qos, 0);
+    }
+#endif
+    return esp_mqtt_client_publish(mqttClient, topic, data, len, mqtt_config.pub_qos, 0);
+}
+
+static void mqtt_publish_task(void* arg) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (1) {
+            mqtt_wait_for_connection(portMAX_DELAY);
+            PublishQueue::message_t m;
+            bool found;
+            uint32_t expiry = 0;
+            // the message buffers belong to the queue, only this task pops so they stay valid after unlocking
+            xSemaphoreTake(queue_lock, portMAX_DELAY);
+            while ((found = queue.pop(m)) && m.state) {
+                uint32_t age = (esp_timer_get_time() - m.time) / 1000000;
+                if (!mqtt_config.mqtt5 || age < MQTT5_STATE_EXPIRY_S) {
+                    expiry = MQTT5_STATE_EXPIRY_S - age;
+                    break;
+                }
+                ++publish_stats.expired;
+            }
+            publish_stats.queued = queue.bytes();
+            bool replaying = found && publish_stats.replay_done < publish_stats.replay_total;
+            if (replaying && ++publish_stats.replay_done == publish_stats.replay_total)
+                ESP_LOGI(TAG, "Sent %u queued messages", (unsigned)publish_stats.replay_total);
+            xSemaphoreGive(queue_lock);
+            if (!found)
+                break;
+            int msg_id = publish(m.topic, m.data, m.len, m.correlation, m.correlation_len, m.state ? expiry : 0, m.state);
+            ESP_LOGD(TAG, "publish to %s: msg_id=%d", m.topic, msg_id); // msg_id > 0 only when QoS > 0
+            if (msg_id < 0)
+                ++publish_stats.dropped;
+            else
+                ++publish_stats.published;
+            if (replaying)
+                vTaskDelay(pdMS_TO_TICKS(1000 / MQTT_REPLAY_RATE));
+        }
+    }
+}
+
+esp_err_t mqtt_subscribe(const char* name, mqtt_callback_t callback) {
     if (!mqttClient)
         return 0;
-    if (!mqttCallback && callback)
-        mqttCallback = callback;
+    size_t len = strlen(name);
+    bool wildcard = len >= 2 && strcmp(name + len - 2, "/#") == 0;
+    if (wildcard)
+        len -= 2;
+    route_t* r = len <= MQTT_MAX_ROUTE && !memchr(name, '/', len) ? route_find(name, len, true) : nullptr;
+    if (!r) {
+        ESP_LOGE(TAG, "mqtt_subscribe '%s': invalid name or too many routes", name);
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(r->name, name, len);
+    r->name[len] = 0;
+    r->len = len;
+    r->wildcard = wildcard;
+    r->callback = callback;
+    char topic[MQTT_MAX_TOPIC + 1];
+    full_topic(name, topic);
     esp_err_t rc = esp_mqtt_client_subscribe(mqttClient, topic, mqtt_config.sub_qos);
     ESP_LOGI(TAG, "mqtt_subscribe '%s': rc=%d", topic, rc);
     return rc;
 }
 
+bool mqtt_valid_topic_id(const char* id) {
+    size_t len = strlen(id);
+    return len && len <= MQTT_MAX_TOPIC_ID && !strpbrk(id, "/+#");
+}
+
 void mqtt_init() {
     mqtt_event_group = xEventGroupCreate();
+    queue_lock = xSemaphoreCreateMutex();
+    if (mqtt_config.legacy_topics)
+        topic_prefix_len = snprintf(topic_prefix, sizeof(topic_prefix), "esp-data-");
+    else
+        topic_prefix_len = snprintf(topic_prefix, sizeof(topic_prefix), MQTT_TOPIC_ROOT "/%s/", mqtt_config.topic_id);
+    topic_prefix_len = std::min(topic_prefix_len, sizeof(topic_prefix) - 1);
+    xTaskCreatePinnedToCore(mqtt_publish_task, "mqtt_publish", 4096, NULL, 5, &publish_task, 0);
     if (mqtt_config.broker.address.uri && mqtt_config.broker.address.uri[0]) {
         xTaskCreatePinnedToCore(mqtt_init_task, "mqtt_init_task", 4096, NULL, 5, NULL, 0);
     }
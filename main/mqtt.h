@@ -1,19 +1,76 @@
 #pragma once
+#include "publish_queue.h"
 #include <freertos/FreeRTOS.h>
 #include <mqtt_client.h>
 
+#define MQTT_REPLAY_RATE 20 // messages/s when sending the backlog after (re)connecting
+#define MQTT_TOPIC_ROOT  "itho"
+#define MQTT_MAX_NAME    16 // longest topic name below the device namespace, e.g. "sniff-bin"
+#define MQTT_ROUTES      16 // inbound router hash table size (power of 2)
+#define MQTT_MAX_ROUTE   15 // longest route name
+// MQTT_TOPIC_ROOT/<topic_id>/<name>, sizeof counts the terminator for one of the slashes
+#define MQTT_MAX_TOPIC_ID (MQTT_MAX_TOPIC - sizeof(MQTT_TOPIC_ROOT) - 1 - MQTT_MAX_NAME)
+
+// MQTT 5 (CONFIG_MQTT_PROTOCOL_5 and mqtt_config.mqtt5)
+#define MQTT5_STATE_EXPIRY_S 60 // message expiry of state messages, also applied to them while queued
+
 struct mqtt_config_t : public esp_mqtt_client_config_t {
     int pub_qos;
     int sub_qos;
+    const char* topic_id; // device namespace: MQTT_TOPIC_ROOT/<topic_id>/<name>
+    bool legacy_topics;   // esp (cmd), esp-data (data, status) and esp-data-<name> instead
+    bool mqtt5;           // topic aliases, message expiry and request/response; needs session.protocol_ver = MQTT_PROTOCOL_V_5
+};
+
+// MQTT 5 request/response: where to send the reply to a request
+struct mqtt_response_t {
+    char topic[MQTT_MAX_TOPIC + 1];
+    uint8_t correlation[MQTT5_MAX_CORRELATION];
+    uint8_t correlation_len;
+};
+
+struct mqtt_publish_stats_t {
+    uint32_t published;
+    uint32_t dropped;      // message too long, no free state slot or publish failed
+    uint32_t evicted;      // oldest event messages dropped to make room
+    uint32_t coalesced;    // state messages replaced by a newer one before they were sent
+    uint32_t superseded;   // event messages dropped because a newer state message made them obsolete
+    uint32_t expired;      // state messages older than MQTT5_STATE_EXPIRY_S when their turn came
+    uint32_t queued;       // bytes waiting now
+    uint32_t high_water;   // most bytes waiting at once
+    uint32_t replay_total; // messages waiting when the last connection was made
+    uint32_t replay_done;  // of which sent
 };
 
 extern mqtt_config_t mqtt_config;
+// A topic_id is a single topic level: not empty, no '/', '+' or '#', and short enough for the namespace plus any name
+bool mqtt_valid_topic_id(const char* id);
 void mqtt_init();
 bool mqtt_is_connected();
 bool mqtt_wait_for_connection(TickType_t delay);
+/*
+    Topics are given by name relative to the device namespace, e.g. "status" is published to itho/<id>/status.
+    Publishing is asynchronous: messages are queued and sent by the mqtt_publish task, so callers never block on the network.
+    mqtt_publish/mqtt_publish_bin append event messages; mqtt_publish_state keeps only the newest pending message of the topic.
+    Messages are sent in the order they were queued, see PublishQueue.
+    While disconnected the queue fills up (evicting the oldest event messages) and is sent at MQTT_REPLAY_RATE after connecting.
+    All return 0 when queued, -1 when dropped.
+*/
 int mqtt_publish(const char* topic, const char* data);
 int mqtt_publish_bin(const char* topic, const char* data, int len);
+// supersedes: event topic whose messages queued before this one are obsolete once it is, e.g. the deltas of a full status
+int mqtt_publish_state(const char* topic, const char* data, int len, const char* supersedes = nullptr);
+mqtt_publish_stats_t mqtt_publish_stats();
+// Response topic and correlation data of the request being handled by a subscribe callback, false if it has none
+bool mqtt_request_response(mqtt_response_t& out);
+// Queues a reply to the response topic of a request, with its correlation data
+int mqtt_publish_response(const mqtt_response_t& to, const char* data, int len);
+// topic is the name relative to the device namespace (not null-terminated)
 typedef void (*mqtt_callback_t)(const char* topic, int topic_len, const char* data, int data_len);
-esp_err_t mqtt_subscribe(const char* topic, mqtt_callback_t callback);
+/*
+    Subscribes to a single level name ("cmd"), or with a "/#" suffix to that name and everything below it ("cmd/#").
+    Inbound messages are routed with a hash lookup of their first level.
+*/
+esp_err_t mqtt_subscribe(const char* name, mqtt_callback_t callback);
 typedef void (*mqtt_connect_callback_t)();
 void mqtt_on_connect(mqtt_connect_callback_t);
@@ -0,0 +1,139 @@
+#include "publish_queue.h"
+#include <algorithm>
+#include <string.h>
+
+// Ring record: record_t, topic, correlation data, payload
+
+void PublishQueue::ring_write(const void* src, size_t len) {
+    size_t pos = (head + used) % MQTT_QUEUE_SIZE;
+    size_t n = std::min(len, MQTT_QUEUE_SIZE - pos);
+    memcpy(ring + pos, src, n);
+    memcpy(ring, (const uint8_t*)src + n, len - n);
+    used += len;
+}
+
+void PublishQueue::ring_peek(void* dst, size_t len) const {
+    size_t n = std::min(len, MQTT_QUEUE_SIZE - head);
+    memcpy(dst, ring + head, n);
+    memcpy((uint8_t*)dst + n, ring, len - n);
+}
+
+void PublishQueue::ring_read(void* dst, size_t len) {
+    ring_peek(dst, len);
+    head = (head + len) % MQTT_QUEUE_SIZE;
+    used -= len;
+}
+
+void PublishQueue::ring_drop() {
+    record_t r;
+    ring_read(&r, sizeof(r));
+    size_t len = r.topic_len + r.correlation_len + r.len;
+    head = (head + len) % MQTT_QUEUE_SIZE;
+    used -= len;
+    --records;
+}
+
+bool PublishQueue::push(const char* topic, const char* data, size_t len, const uint8_t* correlation, size_t correlation_len) {
+    size_t topic_len = strlen(topic);
+    if (!topic_len || topic_len > MQTT_MAX_TOPIC || len > MQTT_MAX_MESSAGE || correlation_len > MQTT5_MAX_CORRELATION) {
+        ++counters.dropped;
+        return false;
+    }
+    record_t r = {next_seq++, (uint16_t)topic_len, (uint16_t)len, (uint16_t)correlation_len};
+    size_t size = sizeof(r) + topic_len + correlation_len + len;
+    while (used + size > MQTT_QUEUE_SIZE) {
+        ring_drop();
+        ++counters.evicted;
+    }
+    ++records;
+    ring_write(&r, sizeof(r));
+    ring_write(topic, topic_len);
+    if (correlation_len)
+        ring_write(correlation, correlation_len);
+    ring_write(data, len);
+    return true;
+}
+
+bool PublishQueue::push_state(const char* topic, const char* data, size_t len, int64_t time, const char* supersedes) {
+    state_slot_t* slot = nullptr;
+    for (auto& s : slots) {
+        if (s.pending && strcmp(s.topic, topic) == 0) {
+            slot = &s;
+            ++counters.coalesced;
+            break;
+        }
+        if (!slot && !s.pending)
+            slot = &s;
+    }
+    if (!slot || !topic[0] || strlen(topic) > MQTT_MAX_TOPIC || len > MQTT_MAX_MESSAGE ||
+        (supersedes && strlen(supersedes) > MQTT_MAX_TOPIC)) {
+        ++counters.dropped;
+        return false;
+    }
+    strcpy(slot->topic, topic);
+    strcpy(slot->supersedes, supersedes ? supersedes : "");
+    memcpy(slot->data, data, len);
+    slot->len = len;
+    slot->time = time;
+    slot->seq = next_seq++;
+    slot->pending = true;
+    return true;
+}
+
+bool PublishQueue::superseded(const char* topic, uint32_t seq) const {
+    for (auto& s : slots) {
+        if (s.pending && (int32_t)(seq - s.seq) < 0 && strcmp(s.supersedes, topic) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool PublishQueue::pop(message_t& out) {
+    // the oldest of the pending state messages and the first ring record
+    state_slot_t* slot = nullptr;
+    for (auto& s : slots) {
+        if (s.pending && (!slot || (int32_t)(s.seq - slot->seq) < 0))
+            slot = &s;
+    }
+    record_t r;
+    while (records) {
+        ring_peek(&r, sizeof(r));
+        if (slot && (int32_t)(r.seq - slot->seq) > 0)
+            break;
+        ring_read(&r, sizeof(r));
+        ring_read(out_topic, r.topic_len);
+        out_topic[r.topic_len] = 0;
+        ring_read(out_correlation, r.correlation_len);
+        ring_read(out_data, r.len);
+        --records;
+        if (superseded(out_topic, r.seq)) {
+            ++counters.superseded;
+            continue;
+        }
+        out = {out_topic, out_data, r.len, out_correlation, r.correlation_len, false, 0};
+        return true;
+    }
+    if (!slot)
+        return false;
+    slot->pending = false;
+    strcpy(out_topic, slot->topic);
+    memcpy(out_data, slot->data, slot->len);
+    out = {out_topic, out_data, slot->len, nullptr, 0, true, slot->time};
+    return true;
+}
+
+size_t PublishQueue::count() const {
+    size_t n = records;
+    for (auto& s : slots)
+        n += s.pending;
+    return n;
+}
+
+size_t PublishQueue::bytes() const {
+    size_t n = used;
+    for (auto& s : slots) {
+        if (s.pending)
+            n += s.len;
+    }
+    return n;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define MQTT_QUEUE_SIZE       16384 // bytes of pending event messages (topic + payload + header), also the offline buffer
+#define MQTT_STATE_SLOTS      3     // state topics that can have a message pending
+#define MQTT_MAX_MESSAGE      2048  // longest payload
+#define MQTT_MAX_TOPIC        64
+#define MQTT5_MAX_CORRELATION 32
+
+/*
+    Outbound message queue of the MQTT publish task.
+    Event messages are appended to a byte ring, evicting the oldest ones when it is full. A state message replaces the
+    pending message of its topic in one of MQTT_STATE_SLOTS slots. Every message is numbered when it is queued (a replacing
+    state message gets a new number) and pop() returns them in that order, so a state message is sent after the event
+    messages queued before it and before the ones queued after it, live and when sending the backlog after a reconnect.
+    A state message can supersede an event topic, e.g. a full status the deltas to the previous one: event messages of that
+    topic queued before the pending state message are dropped instead of being sent.
+    Has no ESP-IDF dependencies and no locking.
+*/
+class PublishQueue {
+  public:
+    struct message_t {
+        const char* topic;
+        const char* data;
+        size_t len;
+        const uint8_t* correlation;
+        size_t correlation_len;
+        bool state;
+        int64_t time; // state messages: as passed to push_state()
+    };
+
+    struct stats_t {
+        uint32_t dropped;    // too long or no free state slot
+        uint32_t evicted;    // oldest event messages dropped to make room
+        uint32_t coalesced;  // state messages replaced by a newer one before they were sent
+        uint32_t superseded; // event messages dropped because a newer state message superseding them was pending
+    };
+
+    // Appends an event message; returns false if it is dropped (no topic, too long)
+    bool push(const char* topic, const char* data, size_t len, const uint8_t* correlation = nullptr, size_t correlation_len = 0);
+    // Queues a state message in place of the pending one of its topic, superseding the event messages of the topic `supersedes`
+    // (if any) queued so far; returns false if it is dropped (no topic, too long, no slot)
+    bool push_state(const char* topic, const char* data, size_t len, int64_t time, const char* supersedes = nullptr);
+    // Removes the oldest message; `out` points into the queue's output buffers until the next pop()
+    bool pop(message_t& out);
+    // Messages waiting
+    size_t count() const;
+    // Topic and payload bytes waiting
+    size_t bytes() const;
+    const stats_t& stats() const { return counters; }
+
+  private:
+    struct record_t {
+        uint32_t seq;
+        uint16_t topic_len, len, correlation_len;
+    };
+    struct state_slot_t {
+        char topic[MQTT_MAX_TOPIC + 1];
+        char supersedes[MQTT_MAX_TOPIC + 1];
+        bool pending;
+        uint32_t seq;
+        uint16_t len;
+        int64_t time;
+        char data[MQTT_MAX_MESSAGE];
+    };
+
+    void ring_write(const void* src, size_t len);
+    void ring_peek(void* dst, size_t len) const;
+    void ring_read(void* dst, size_t len);
+    void ring_drop();
+    bool superseded(const char* topic, uint32_t seq) const;
+
+    uint8_t ring[MQTT_QUEUE_SIZE];
+    size_t head = 0, used = 0, records = 0;
+    state_slot_t slots[MQTT_STATE_SLOTS] = {};
+    uint32_t next_seq = 0;
+    stats_t counters = {};
+    char out_topic[MQTT_MAX_TOPIC + 1];
+    char out_data[MQTT_MAX_MESSAGE];
+    uint8_t out_correlation[MQTT5_MAX_CORRELATION];
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Lock-free single-producer/single-consumer ring buffer with a fixed capacity.
+    The producer (typically an ISR) only writes `head`, the consumer only writes `tail`,
+    so no locks or critical sections are needed; on the ESP32 the atomics compile to plain loads/stores.
+    A push into a full ring is dropped and counted in overflows().
+*/
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N && (N & (N - 1)) == 0, "SpscRing capacity must be a power of 2");
+
+  public:
+    inline __attribute__((always_inline)) bool push(const T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= N) {
+            overflow_count.store(overflow_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        buf[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Copies up to `max` items into `out`, returns the number of items copied
+    size_t pop(T* out, size_t max) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        size_t n = head.load(std::memory_order_acquire) - t;
+        if (n > max)
+            n = max;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = buf[(t + i) & (N - 1)];
+        }
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return N; }
+    uint32_t overflows() const { return overflow_count.load(std::memory_order_relaxed); }
+
+  private:
+    T buf[N];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> overflow_count{0};
+};
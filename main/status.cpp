@@ -0,0 +1,47 @@
+#include "status.h"
+
+bool StatusPlan::compile(const uint8_t* formats, size_t n) {
+    count = 0;
+    uint16_t offset = 0;
+    for (size_t i = 0; i < n && count < STATUS_MAX_FIELDS; ++i) {
+        uint8_t f = formats[i];
+        field_t& p = plan[count++];
+        switch (f) {
+        case 0x0C:
+            p = {offset, 1, FIELD_UNSIGNED, 0};
+            break;
+        case 0x0F:
+            p = {offset, 1, FIELD_HALF, 1};
+            break;
+        case 0x5B:
+            p = {offset, 2, FIELD_UNSIGNED, 0};
+            break;
+        case 0x6C:
+            p = {offset, 1, FIELD_BOOL, 0};
+            break;
+        default:
+            p = {offset, (uint8_t)(1 << ((f >> 4) & 3)), (uint8_t)((f & 0x80) ? FIELD_SIGNED : FIELD_UNSIGNED), (uint8_t)(f & 7)};
+        }
+        offset += p.width;
+    }
+    return count == n;
+}
+
+size_t StatusPlan::decode(const uint8_t* data, size_t len, int64_t* values, size_t max) const {
+    size_t i = 0;
+    for (; i < count && i < max; ++i) {
+        const field_t& p = plan[i];
+        if (p.offset + p.width > len)
+            break;
+        const uint8_t* d = data + p.offset;
+        int64_t x = p.kind == FIELD_SIGNED ? (int8_t)d[0] : d[0];
+        for (int j = 1; j < p.width; ++j)
+            x = (x << 8) | d[j];
+        if (p.kind == FIELD_HALF)
+            x *= 5;
+        else if (p.kind == FIELD_BOOL)
+            x = x != 0;
+        values[i] = x;
+    }
+    return i;
+}
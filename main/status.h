@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define STATUS_MAX_FIELDS 64
+
+/*
+    Decode plan for the A4 01 status reply, compiled once from the A4 00 format list.
+
+    Format byte:
+    bit 7: signed / unsigned
+    bits 6..4: size (2^n): 0=1, 1=2, 2=4
+    bits 3..0: decimal digits (divider 10^n)
+    Special cases: 0C = unsigned 1 byte, 0F = unsigned 1 byte * 0.5, 5B = unsigned 2 bytes, 6C = 1 byte boolean
+
+    Has no ESP-IDF dependencies and does not allocate.
+*/
+class StatusPlan {
+  public:
+    // Replaces the plan; returns false if the list has more than STATUS_MAX_FIELDS entries (the rest is ignored)
+    bool compile(const uint8_t* formats, size_t count);
+    void clear() { count = 0; }
+    size_t fields() const { return count; }
+    // Decodes the fields present in `data` into values in units of 10^-decimals(i); returns the number of fields decoded
+    size_t decode(const uint8_t* data, size_t len, int64_t* values, size_t max) const;
+    unsigned decimals(size_t i) const { return plan[i].decimals; }
+
+  private:
+    enum : uint8_t { FIELD_UNSIGNED, FIELD_SIGNED, FIELD_HALF, FIELD_BOOL };
+    struct field_t {
+        uint16_t offset;
+        uint8_t width;
+        uint8_t kind;
+        uint8_t decimals;
+    };
+    field_t plan[STATUS_MAX_FIELDS];
+    size_t count = 0;
+};
@@ -0,0 +1,41 @@
+#include "telemetry.h"
+#include <string.h>
+
+void TelemetryEncoder::varint(uint64_t x) {
+    while (x >= 0x80) {
+        buf[len++] = (uint8_t)x | 0x80;
+        x >>= 7;
+    }
+    buf[len++] = x;
+}
+
+bool TelemetryEncoder::fits(const uint8_t* decimals, size_t n) const {
+    if (!count)
+        return 5 + n + max_sample_size(n) <= size;
+    return buf[2] == n && memcmp(buf + 5, decimals, n) == 0 && count < 0xFFFF && len + max_sample_size(n) <= size;
+}
+
+bool TelemetryEncoder::add(uint32_t t, const int64_t* values, const uint8_t* decimals, size_t n) {
+    if (n > MAX_VALUES || !fits(decimals, n))
+        return false;
+    if (!count) {
+        buf[0] = TELEMETRY_MAGIC;
+        buf[1] = TELEMETRY_VERSION;
+        buf[2] = n;
+        memcpy(buf + 5, decimals, n);
+        len = 5 + n;
+        last_t = 0;
+        memset(last, 0, sizeof(last[0]) * n);
+    }
+    varint(t - last_t);
+    last_t = t;
+    for (size_t i = 0; i < n; ++i) {
+        int64_t d = values[i] - last[i];
+        varint(((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+        last[i] = values[i];
+    }
+    ++count;
+    buf[3] = count & 0xFF;
+    buf[4] = count >> 8;
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define TELEMETRY_MAGIC   0x49
+#define TELEMETRY_VERSION 1
+
+/*
+    Binary telemetry batch, all multi-byte values little endian:
+
+    header:  u8 magic (TELEMETRY_MAGIC), u8 version, u8 value count N, u16 sample count, N x u8 decimals
+    samples: varint time (first sample: uptime s, then s since the previous sample),
+             N x zigzag varint value (first sample: the value, then the difference to the previous sample)
+
+    Values are status values in units of 10^-decimals, the decimals come from the A4 00 status format.
+    Decoder: tools/itho_telemetry.py
+*/
+class TelemetryEncoder {
+  public:
+    TelemetryEncoder(uint8_t* buf, size_t size) : buf(buf), size(size) {}
+
+    // Appends a sample, starting a new batch if none is open; returns false if it does not fit or has a different schema
+    bool add(uint32_t t, const int64_t* values, const uint8_t* decimals, size_t n);
+    // True if a sample with this schema can be added to the open batch
+    bool fits(const uint8_t* decimals, size_t n) const;
+    void clear() { len = count = 0; }
+    const uint8_t* data() const { return buf; }
+    size_t length() const { return len; }
+    size_t samples() const { return count; }
+
+    static constexpr size_t MAX_VALUES = 255;
+    static constexpr size_t max_sample_size(size_t n) { return 5 + 10 * n; }
+
+  private:
+    void varint(uint64_t x);
+
+    uint8_t* buf;
+    size_t size;
+    size_t len = 0;
+    size_t count = 0;
+    uint32_t last_t = 0;
+    int64_t last[MAX_VALUES];
+};
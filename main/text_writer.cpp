@@ -0,0 +1,32 @@
+#include "text_writer.h"
+#include "util.h"
+
+TextWriter& TextWriter::str(const char* s, size_t n) {
+    if (len + n >= size) {
+        n = size - 1 - len;
+        overflowed = true;
+    }
+    memcpy(buf + len, s, n);
+    len += n;
+    buf[len] = 0;
+    return *this;
+}
+
+TextWriter& TextWriter::fixed(int64_t x, unsigned decimals) {
+    char tmp[24];
+    return str(tmp, formatFixed(tmp, x, decimals));
+}
+
+TextWriter& TextWriter::hex(uint8_t x) {
+    char tmp[2] = {toHex(x >> 4), toHex(x & 0xF)};
+    return str(tmp, 2);
+}
+
+TextWriter& TextWriter::hex(const uint8_t* data, size_t n) {
+    for (size_t i = 0; i < n && !overflowed; ++i) {
+        if (i)
+            ch(' ');
+        hex(data[i]);
+    }
+    return *this;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+    Bounded text writer over a fixed buffer, for building MQTT payloads without heap allocation.
+    Output that does not fit is cut off and sets overflow(); the text is always null terminated.
+*/
+class TextWriter {
+  public:
+    TextWriter(char* buf, size_t size) : buf(buf), size(size) { buf[0] = 0; }
+
+    TextWriter& str(const char* s, size_t n);
+    TextWriter& str(const char* s) { return str(s, strlen(s)); }
+    TextWriter& ch(char c) { return str(&c, 1); }
+    TextWriter& num(int64_t x) { return fixed(x, 0); }
+    // x / 10^decimals, see formatFixed()
+    TextWriter& fixed(int64_t x, unsigned decimals);
+    // two upper case hex digits
+    TextWriter& hex(uint8_t x);
+    // hex bytes separated by spaces
+    TextWriter& hex(const uint8_t* data, size_t n);
+
+    const char* c_str() const { return buf; }
+    size_t length() const { return len; }
+    size_t available() const { return size - 1 - len; }
+    bool overflow() const { return overflowed; }
+    void clear() {
+        len = 0;
+        overflowed = false;
+        buf[0] = 0;
+    }
+
+  protected:
+    // For derived classes owning the buffer: it is constructed after the base, so they terminate it themselves
+    struct unterminated_t {};
+    TextWriter(char* buf, size_t size, unterminated_t) : buf(buf), size(size) {}
+
+  private:
+    char* buf;
+    size_t size;
+    size_t len = 0;
+    bool overflowed = false;
+};
+
+// TextWriter with its own storage
+template <size_t N>
+class TextBuffer : public TextWriter {
+  public:
+    TextBuffer() : TextWriter(storage, N, unterminated_t{}) { storage[0] = 0; }
+
+  private:
+    char storage[N];
+};
@@ -0,0 +1,33 @@
+#include "topic_alias.h"
+#include <algorithm>
+#include <string.h>
+
+void TopicAliases::connected(uint16_t limit) {
+    max = std::min<uint16_t>(limit, MQTT5_TOPIC_ALIASES);
+    std::fill_n(sent, MQTT5_TOPIC_ALIASES, false);
+}
+
+uint16_t TopicAliases::get(const char* topic, bool& send_topic) {
+    send_topic = true;
+    if (strlen(topic) > MQTT_MAX_TOPIC)
+        return 0;
+    for (int i = 0; i < MQTT5_TOPIC_ALIASES; ++i) {
+        if (!topics[i][0])
+            strcpy(topics[i], topic);
+        if (strcmp(topics[i], topic) == 0) {
+            if (i >= max)
+                return 0;
+            send_topic = !sent[i];
+            sent[i] = true;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+void TopicAliases::rejected(uint16_t alias) {
+    if (alias < 1 || alias > MQTT5_TOPIC_ALIASES)
+        return;
+    sent[alias - 1] = false;
+    max = std::min<uint16_t>(max, alias - 1);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "publish_queue.h"
+#include <cstddef>
+#include <cstdint>
+
+#define MQTT5_TOPIC_ALIASES 8 // most topics with an alias, the broker's Topic Alias Maximum may allow fewer
+
+/*
+    MQTT 5 topic aliases of the publisher, assigned to topics on first use. An alias is only valid on the connection it
+    was sent on with its topic: connected() forgets which ones were sent and lifts the limit to MQTT5_TOPIC_ALIASES again.
+    The broker's Topic Alias Maximum is learned from rejected(), i.e. when the client library refuses an alias above it.
+    Has no ESP-IDF dependencies and no locking.
+*/
+class TopicAliases {
+  public:
+    // A new connection; limit = Topic Alias Maximum of the broker if known
+    void connected(uint16_t limit = MQTT5_TOPIC_ALIASES);
+    // Alias to publish `topic` with, 0 = none (table full or above the limit); send_topic is set when the topic has to be
+    // sent along, on its first use on this connection
+    uint16_t get(const char* topic, bool& send_topic);
+    // The alias is above what the broker accepts: no aliases from it on for this connection, and the topic was not sent
+    void rejected(uint16_t alias);
+    uint16_t limit() const { return max; }
+
+  private:
+    char topics[MQTT5_TOPIC_ALIASES][MQTT_MAX_TOPIC + 1] = {};
+    bool sent[MQTT5_TOPIC_ALIASES] = {};
+    uint16_t max = MQTT5_TOPIC_ALIASES;
+};
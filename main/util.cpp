@@ -24,4 +24,33 @@ std::string toHexStr(const uint8_t* data, unsigned len) {
         s += toHex(data[i] & 0xF);
     }
     return s;
-}
\ No newline at end of file
+}
+size_t formatFixed(char* buf, int64_t x, unsigned decimals) {
+    char digits[20];
+    uint64_t u = x < 0 ? 0 - (uint64_t)x : x;
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while ((u || n <= decimals) && n < sizeof(digits));
+    char* p = buf;
+    if (x < 0)
+        *p++ = '-';
+    while (n > decimals)
+        *p++ = digits[--n];
+    if (decimals) {
+        *p++ = '.';
+        while (n)
+            *p++ = digits[--n];
+    }
+    return p - buf;
+}
+
+size_t fixedLength(int64_t x, unsigned decimals) {
+    uint64_t u = x < 0 ? 0 - (uint64_t)x : x;
+    size_t n = 1;
+    for (uint64_t p = 10; n < 20 && u >= p; p *= 10)
+        ++n;
+    n = n > decimals ? n : decimals + 1;
+    return (x < 0) + n + (decimals ? 1 : 0);
+}
@@ -22,3 +22,9 @@ inline void fixChecksum(uint8_t* buf, size_t buflen) { buf[buflen - 1] = checksu
 inline char toHex(uint8_t c) { return c < 10 ? c + '0' : c + 'A' - 10; }
 
 std::string toHexStr(const uint8_t* data, unsigned len);
+
+// Formats x / 10^decimals with exactly `decimals` digits after the point, e.g. (-5, 2) -> "-0.05".
+// Writes at most 22 characters, no terminator; returns the length
+size_t formatFixed(char* buf, int64_t x, unsigned decimals);
+// Length of formatFixed(x, decimals) without formatting it
+size_t fixedLength(int64_t x, unsigned decimals);
@@ -0,0 +1,22 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+
+// Keeps the compiler from optimizing away a benchmarked result
+template <typename T>
+inline void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs f() `iterations` times and prints the time per iteration in ns, returns it
+template <typename F>
+double bench(const char* name, long iterations, F f) {
+    for (long i = 0; i < iterations / 10; ++i) // warm up
+        f();
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i)
+        f();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    printf("%-40s %10.1f ns\n", name, ns);
+    return ns;
+}
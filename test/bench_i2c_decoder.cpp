@@ -0,0 +1,45 @@
+#include "bench.h"
+#include "i2c_decoder.h"
+#include <vector>
+
+// Decoding speed on a synthetic bus: 100 kHz frames of 8 bytes, all ACKed
+int main() {
+    const uint32_t tpu = 240, half = 5 * tpu;
+    std::vector<uint32_t> ticks;
+    std::vector<uint8_t> lines;
+    uint32_t t = 0;
+    uint8_t cur = I2cDecoder::LINE_SCL | I2cDecoder::LINE_SDA;
+    auto set = [&](uint8_t l) {
+        if (l == cur)
+            return;
+        cur = l;
+        ticks.push_back(t);
+        lines.push_back(l);
+    };
+    const uint8_t SCL = I2cDecoder::LINE_SCL, SDA = I2cDecoder::LINE_SDA;
+    size_t bytes = 0;
+    for (int frame = 0; frame < 2000; ++frame) {
+        t += half, set(SCL);
+        t += half, set(0);
+        for (int b = 0; b < 8; ++b, ++bytes) {
+            uint8_t v = frame * 8 + b;
+            for (int i = 0; i < 9; ++i) {
+                uint8_t sda = i < 8 && (v >> (7 - i)) & 1 ? SDA : 0;
+                t += half / 2, set(sda);
+                t += half / 2, set(sda | SCL);
+                t += half, set(sda);
+            }
+        }
+        t += half / 2, set(0);
+        t += half / 2, set(SCL);
+        t += half, set(SCL | SDA);
+    }
+    std::vector<sniffer_event_t> events(ticks.size());
+    size_t n = 0;
+    double ns = bench("decode 2000 frames", 200, [&] {
+        I2cDecoder decoder(tpu);
+        n = decoder.decode(ticks.data(), lines.data(), ticks.size(), events.data(), events.size());
+        keep(n);
+    });
+    printf("%zu edges, %zu events: %.1f ns/edge, %.2f M decoded bytes/s\n", ticks.size(), n, ns / ticks.size(), bytes / ns * 1000);
+}
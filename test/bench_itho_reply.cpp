@@ -0,0 +1,40 @@
+#include "bench.h"
+#include "itho_reply.h"
+#include "util.h"
+#include <string>
+
+static size_t sink;
+static void handler(const uint8_t* payload, size_t len) { sink += payload[0] + len; }
+static bool checksumOk(const uint8_t* data, size_t len) { return checksum(data, len - 1) == data[len - 1]; }
+
+// Dispatch of a 32 byte status reply through the handler table, against the if-chain plus hex formatting it replaced
+int main() {
+    itho_reply_register(0xA400, ITHO_REPLY_FLAGS, handler);
+    itho_reply_register(0xA401, ITHO_REPLY_FLAGS, handler);
+    itho_reply_register(0x90E0, ITHO_REPLY_FLAGS, handler);
+    itho_reply_register(0x90E1, ITHO_REPLY_FLAGS, handler);
+    uint8_t frame[64] = {0x80, 0x82, 0xA4, 0x01, 0x01, 0x20};
+    for (int i = 0; i < 32; ++i)
+        frame[ITHO_REPLY_HEADER_LEN + i] = i;
+    const size_t len = ITHO_REPLY_HEADER_LEN + 32 + 1;
+    uint8_t n = 0;
+
+    double table = bench("handler table", 2000000, [&] {
+        frame[7] = ++n;
+        fixChecksum(frame, len);
+        keep(itho_reply_dispatch(frame, len));
+    });
+    double chain = bench("if-chain + hex string", 2000000, [&] {
+        frame[7] = ++n;
+        fixChecksum(frame, len);
+        std::string s = toHexStr(frame, len);
+        const uint8_t* data = frame;
+        if (len > 6 && data[1] == 0x82 && data[2] == 0xA4 && data[3] == 0 && data[4] == 1 && data[5] < len - 5 && checksumOk(data, len))
+            handler(data + 6, data[5]);
+        if (len > 6 && data[1] == 0x82 && data[2] == 0xA4 && data[3] == 1 && data[4] == 1 && data[5] < len - 5 && checksumOk(data, len))
+            handler(data + 6, len - 7);
+        sink += s.size();
+    });
+    keep(sink);
+    printf("table is %.1fx faster\n", chain / table);
+}
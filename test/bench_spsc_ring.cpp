@@ -0,0 +1,41 @@
+#include "bench.h"
+#include "spsc_ring.h"
+#include <chrono>
+#include <thread>
+
+struct record_t {
+    uint32_t tm;
+    uint16_t data;
+    uint16_t dt;
+};
+
+int main() {
+    static SpscRing<record_t, 1024> ring;
+    record_t out[64];
+    uint32_t i = 0;
+    bench("push + pop batches of 32", 1000000, [&] {
+        for (int k = 0; k < 32; ++k)
+            ring.push({i++, 0, 0});
+        keep(ring.pop(out, 64));
+    });
+
+    // producer thread against a consumer draining in batches, as sniffer ISR and task; the producer retries when full
+    const uint32_t total = 20000000;
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([&] {
+        for (uint32_t n = 0; n < total; ++n) {
+            while (!ring.push({n, 0, 0}))
+                std::this_thread::yield();
+        }
+    });
+    uint64_t received = 0;
+    while (received < total) {
+        size_t n = ring.pop(out, 64);
+        received += n;
+        if (!n)
+            std::this_thread::yield();
+    }
+    producer.join();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("two threads: %.1f M records/s (%u hardware threads)\n", received / s / 1e6, std::thread::hardware_concurrency());
+}
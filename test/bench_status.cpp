@@ -0,0 +1,64 @@
+#include "bench.h"
+#include "status.h"
+#include "util.h"
+#include <cstring>
+#include <string>
+
+static const uint8_t formats[] = {0x91, 0x11, 0x10, 0x90, 0x10, 0x90, 0x92, 0x92, 0x00, 0x92, 0x92,
+                                  0x00, 0x00, 0x91, 0x00, 0x10, 0x10, 0x00, 0x90, 0x00, 0x00, 0x10};
+static const uint8_t status[] = {0x00, 0x00, 0x03, 0x9C, 0x03, 0x9E, 0x03, 0x98, 0x03, 0xEB, 0x03, 0xEB, 0x09,
+                                 0x09, 0x09, 0x8A, 0x00, 0x09, 0x09, 0x09, 0x8A, 0x00, 0x00, 0x0B, 0xB8, 0x01,
+                                 0x00, 0x00, 0x00, 0xB1, 0x79, 0x00, 0x00, 0x00, 0x00, 0x10, 0x95};
+
+// The status formatting before the decode plan: walks the format list per reply and formats with snprintf
+static std::string oldStatus(const uint8_t* data, size_t len) {
+    std::string s(1, '[');
+    char buf[64];
+    s.reserve(4 * len + 4);
+    size_t i = 0;
+    for (uint8_t dt : formats) {
+        if (i >= len)
+            break;
+        if (s.length() > 1)
+            s += ',';
+        int32_t x = (dt & 0x80) ? (int8_t)data[i++] : data[i++];
+        for (int j = (1 << ((dt >> 4) & 3)); j > 1; --j)
+            x = (x << 8) | data[i++];
+        int rem = dt & 7;
+        snprintf(buf, sizeof(buf), "%0*ld", (int)(rem + 1 + (x < 0)), (long int)x);
+        size_t n = strlen(buf);
+        s.append(buf, n - rem);
+        if (rem) {
+            s += '.';
+            s.append(buf + n - rem, rem);
+        }
+    }
+    s += ']';
+    return s;
+}
+
+// Formatting of one 22 field status reply
+int main() {
+    StatusPlan plan;
+    plan.compile(formats, sizeof(formats));
+    int64_t values[STATUS_MAX_FIELDS];
+    char out[512];
+
+    double old = bench("format list walk + snprintf", 500000, [&] { keep(oldStatus(status, sizeof(status)).size()); });
+    bench("StatusPlan::decode", 500000, [&] { keep(plan.decode(status, sizeof(status), values, STATUS_MAX_FIELDS)); });
+    double now = bench("StatusPlan::decode + formatFixed", 500000, [&] {
+        size_t n = plan.decode(status, sizeof(status), values, STATUS_MAX_FIELDS);
+        char* p = out;
+        *p++ = '[';
+        for (size_t i = 0; i < n; ++i) {
+            if (i)
+                *p++ = ',';
+            p += formatFixed(p, values[i], plan.decimals(i));
+        }
+        *p++ = ']';
+        keep(p);
+    });
+    bench("formatFixed(-12345, 2)", 5000000, [&] { keep(formatFixed(out, -12345, 2)); });
+    bench("snprintf(-12345, 2)", 5000000, [&] { keep(snprintf(out, sizeof(out), "%0*ld", 4, -12345L)); });
+    printf("decode + formatFixed is %.1fx faster\n", old / now);
+}
@@ -0,0 +1,42 @@
+#include "bench.h"
+#include "text_writer.h"
+#include <cstdio>
+
+// Building the dht payload "[65.3,21.5,0]" and a status list of 22 values, against snprintf
+int main() {
+    const int hum = 653, temp = 215;
+    int ret = 0;
+    double s1 = bench("dht payload, snprintf", 2000000, [&] {
+        char buf[64];
+        keep(snprintf(buf, sizeof(buf), "[%d.%d,%d.%d,%d]", hum / 10, hum % 10, temp / 10, temp % 10, ret++ & 1));
+    });
+    double w1 = bench("dht payload, TextBuffer", 2000000, [&] {
+        TextBuffer<64> w;
+        w.ch('[').fixed(hum, 1).ch(',').fixed(temp, 1).ch(',').num(ret++ & 1).ch(']');
+        keep(w.length());
+    });
+
+    const int values[] = {0, 924, 926, 920, 1003, 1003, 2313, 2442, 0, 2313, 2442, 0, 0, 3000, 1, 0, 177, 121, 0, 0, 0, 4245};
+    const unsigned decimals[] = {1, 1, 0, 0, 0, 0, 2, 2, 0, 2, 2, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0};
+    const size_t n = sizeof(values) / sizeof(values[0]);
+    double s2 = bench("status list, snprintf", 500000, [&] {
+        char buf[512];
+        int len = 0;
+        for (size_t i = 0; i < n && len < (int)sizeof(buf); ++i) {
+            if (!decimals[i]) {
+                len += snprintf(buf + len, sizeof(buf) - len, "%c%d", i ? ',' : '[', values[i]);
+            } else {
+                int div = decimals[i] == 1 ? 10 : 100;
+                len += snprintf(buf + len, sizeof(buf) - len, "%c%d.%0*d", i ? ',' : '[', values[i] / div, (int)decimals[i], values[i] % div);
+            }
+        }
+        keep(len);
+    });
+    double w2 = bench("status list, TextBuffer", 500000, [&] {
+        TextBuffer<512> w;
+        for (size_t i = 0; i < n; ++i)
+            w.ch(i ? ',' : '[').fixed(values[i], decimals[i]);
+        keep(w.length());
+    });
+    printf("TextBuffer is %.1fx (dht) and %.1fx (status) faster\n", s1 / w1, s2 / w2);
+}
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""
+Generates the I2C edge trace fixtures of test_i2c_decoder and the events the decoder must produce for them.
+
+Usage: make_i2c_traces.py [output dir]
+
+<name>.trace:    one line per edge, "<CPU cycle count> <SCL><SDA>" with the line levels after the edge, 240 cycles per us
+                 (test_i2c_capture splits them into the RMT captures of the two lines)
+<name>.expected: one line per event, "<tm us> <dt us> [START ]<byte> ACK|NACK" or "<tm us> <dt us> STOP",
+                 times relative to the first edge
+"""
+import os
+import sys
+
+TICKS_PER_US = 240
+
+
+class Bus:
+    def __init__(self, tick=0, half_us=5.0):
+        self.tick = tick
+        self.half = int(half_us * TICKS_PER_US)
+        self.scl = self.sda = 1
+        self.t0 = None
+        self.edges = []
+        self.events = []
+        self.start_us = self.byte_us = 0
+        self.start_flag = False
+
+    def now(self):
+        return (self.tick - self.t0) // TICKS_PER_US
+
+    def wait(self, ticks):
+        self.tick += int(ticks)
+
+    def set(self, scl=None, sda=None):
+        new = (self.scl if scl is None else scl, self.sda if sda is None else sda)
+        if new == (self.scl, self.sda):
+            return
+        self.scl, self.sda = new
+        if self.t0 is None:
+            self.t0 = self.tick
+        self.edges.append((self.tick % 2**32, self.scl, self.sda))
+
+    def start(self):
+        if not self.scl:  # repeated start
+            self.wait(self.half / 2)
+            self.set(sda=1)
+            self.wait(self.half / 2)
+            self.set(scl=1)
+        self.wait(self.half)
+        self.set(sda=0)
+        self.start_us = self.byte_us = self.now()
+        self.start_flag = True
+        self.wait(self.half)
+        self.set(scl=0)
+
+    def bit(self, value, stretch_us=0):
+        """clocks a bit, returns the time of the SCL rising edge"""
+        self.wait(self.half / 2)
+        self.set(sda=value)
+        self.wait(self.half / 2 + stretch_us * TICKS_PER_US)
+        self.set(scl=1)
+        now = self.now()
+        self.wait(self.half)
+        return now
+
+    def byte(self, value, ack=True, stretch_us=0, bits=8):
+        for i in range(bits):
+            self.bit((value >> (7 - i)) & 1, stretch_us if i == 0 else 0)
+            self.set(scl=0)
+        if bits < 8:
+            return
+        now = self.bit(0 if ack else 1)
+        self.events.append(f"{now} {now - self.byte_us} {'START ' if self.start_flag else ''}{value:02X} {'ACK' if ack else 'NACK'}")
+        self.byte_us = now
+        self.start_flag = False
+        self.set(scl=0)
+
+    def stop(self):
+        self.wait(self.half / 2)
+        self.set(sda=0)
+        self.wait(self.half / 2)
+        self.set(scl=1)
+        self.wait(self.half)
+        self.set(sda=1)
+        now = self.now()
+        self.events.append(f"{now} {now - self.start_us} STOP")
+        self.wait(50 * TICKS_PER_US)
+
+
+def itho_write(bus, data, stretch_us=0):
+    bus.start()
+    for i, b in enumerate(data):
+        bus.byte(b, stretch_us=stretch_us if i == 1 else 0)
+    bus.stop()
+
+
+def fixtures():
+    status_query = [0x82, 0x80, 0xA4, 0x01, 0x04, 0x00, 0xD5]
+
+    # master write of a status query at 100 kHz, the slave stretches the clock 40 us after the address
+    bus = Bus(tick=1000)
+    itho_write(bus, status_query, stretch_us=40)
+    itho_write(bus, [0x80, 0x82, 0xA4, 0x01, 0x01, 0x03, 0x00, 0x55])
+    yield "itho_write", bus
+
+    # write register, repeated start, read 3 bytes with the last one NACKed
+    bus = Bus(tick=5000)
+    bus.start()
+    bus.byte(0x82)
+    bus.byte(0x90)
+    bus.start()
+    bus.byte(0x83)
+    bus.byte(0x12)
+    bus.byte(0xFF)
+    bus.byte(0x00, ack=False)
+    bus.stop()
+    yield "read_nack", bus
+
+    # a frame broken off in the middle of a byte by a new START: the partial byte is discarded
+    bus = Bus(tick=0)
+    bus.start()
+    bus.byte(0x82)
+    bus.byte(0x80, bits=4)
+    bus.start()
+    bus.byte(0x82)
+    bus.byte(0x60)
+    bus.stop()
+    yield "truncated", bus
+
+    # 400 kHz with the cycle counter wrapping around in the middle of the frame
+    bus = Bus(tick=2**32 - 60 * TICKS_PER_US, half_us=1.25)
+    itho_write(bus, status_query)
+    yield "wrap_400khz", bus
+
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    for name, bus in fixtures():
+        with open(os.path.join(out, name + ".trace"), "w") as f:
+            f.writelines(f"{tick} {scl}{sda}\n" for tick, scl, sda in bus.edges)
+        with open(os.path.join(out, name + ".expected"), "w") as f:
+            f.writelines(e + "\n" for e in bus.events)
+
+
+if __name__ == "__main__":
+    main()
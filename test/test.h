@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdio>
+#include <string>
+
+// Minimal checks for the host tests: failures are printed and counted, main() returns test_result()
+inline int test_failures;
+
+#define CHECK(cond)                                                                                                                        \
+    do {                                                                                                                                   \
+        if (!(cond)) {                                                                                                                     \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                                               \
+            ++test_failures;                                                                                                               \
+        }                                                                                                                                  \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                                                                     \
+    do {                                                                                                                                   \
+        auto a_ = (a);                                                                                                                     \
+        auto b_ = (b);                                                                                                                     \
+        if (!(a_ == b_)) {                                                                                                                 \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, (long long)a_, (long long)b_);         \
+            ++test_failures;                                                                                                               \
+        }                                                                                                                                  \
+    } while (0)
+
+#define CHECK_STR(a, b)                                                                                                                    \
+    do {                                                                                                                                   \
+        std::string a_(a), b_(b);                                                                                                          \
+        if (a_ != b_) {                                                                                                                    \
+            printf("%s:%d: CHECK_STR(%s, %s) failed: '%s' != '%s'\n", __FILE__, __LINE__, #a, #b, a_.c_str(), b_.c_str());              \
+            ++test_failures;                                                                                                               \
+        }                                                                                                                                  \
+    } while (0)
+
+inline int test_result() {
+    if (test_failures)
+        printf("%d check(s) failed\n", test_failures);
+    else
+        printf("ok\n");
+    return test_failures != 0;
+}
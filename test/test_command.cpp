@@ -0,0 +1,162 @@
+#include "command.h"
+#include "test.h"
+#include <cstring>
+#include <string>
+
+static const CommandArgs* last; // arguments of the last handler call
+static bool handler(const CommandArgs& args) {
+    last = &args;
+    return true;
+}
+static bool failing(const CommandArgs& args) { return false; }
+
+static constexpr Command commands[] = {
+    {"set1", ArgType::NONE, 0, 0, CMD_ANY, handler, ""},
+    {"set2", ArgType::NONE, 0, 0, CMD_ANY, handler, ""},
+    {"poll", ArgType::INT, 0, 2, CMD_ANY, handler, ""},
+    {"ints", ArgType::INT, 1, COMMAND_MAX_INTS, CMD_ANY, handler, ""},
+    {"filter", ArgType::TEXT, 0, 5, CMD_ANY, handler, ""},
+    {"send", ArgType::HEX, 1, COMMAND_MAX_BYTES, CMD_ANY, handler, ""},
+    {"s", ArgType::NONE, 0, 0, CMD_CONSOLE, handler, ""},
+    {"fail", ArgType::NONE, 0, 0, CMD_ANY, failing, ""},
+};
+static constexpr CommandTable table(commands);
+static CommandArgs args;
+static std::string line; // args.text points into it
+
+static CommandResult run(const std::string& s, uint8_t source = CMD_MQTT) {
+    last = nullptr;
+    line = s;
+    args.response = nullptr;
+    CommandResult rc = table.run(line.data(), line.size(), source, args);
+    CHECK((rc == CommandResult::OK || rc == CommandResult::FAILED) == (last != nullptr || line == "fail"));
+    return rc;
+}
+
+// "ints" arguments as "a b c", or "bad" when they are rejected
+static std::string ints(const std::string& arguments) {
+    if (run("ints " + arguments) != CommandResult::OK)
+        return "bad";
+    std::string s;
+    for (size_t i = 0; i < args.count; ++i) {
+        if (i)
+            s += ' ';
+        s += std::to_string(args.ints[i]);
+    }
+    return s;
+}
+
+// "send" arguments as hex bytes "82 60", or "bad"
+static std::string hex(const std::string& arguments) {
+    if (run("send " + arguments) != CommandResult::OK)
+        return "bad";
+    std::string s;
+    for (size_t i = 0; i < args.count; ++i) {
+        char b[4];
+        snprintf(b, sizeof(b), i ? " %02X" : "%02X", args.bytes[i]);
+        s += b;
+    }
+    return s;
+}
+
+static void testNames() {
+    CHECK(run("set1") == CommandResult::OK);
+    CHECK(run("  set2  ") == CommandResult::OK);
+    CHECK(table.find("set1", 4) == &commands[0]);
+    CHECK(table.find("set1 x", 4) == &commands[0]);
+    // exact names only: no prefixes, no extensions, case sensitive
+    CHECK(run("set") == CommandResult::UNKNOWN);
+    CHECK(run("se") == CommandResult::UNKNOWN);
+    CHECK(run("set12") == CommandResult::UNKNOWN);
+    CHECK(run("set1set2") == CommandResult::UNKNOWN);
+    CHECK(run("SET1") == CommandResult::UNKNOWN);
+    CHECK(run("") == CommandResult::UNKNOWN);
+    CHECK(run("   ") == CommandResult::UNKNOWN);
+    CHECK(table.find("set", 3) == nullptr);
+    CHECK(table.find("s", 1) == &commands[6]);
+    CHECK(run("set1 x") == CommandResult::BAD_ARGS);
+    CHECK(run("fail") == CommandResult::FAILED);
+}
+
+static void testSources() {
+    // console only commands are not run from MQTT
+    CHECK(run("s", CMD_MQTT) == CommandResult::NOT_AVAILABLE);
+    CHECK(run("s x", CMD_MQTT) == CommandResult::NOT_AVAILABLE);
+    CHECK(run("s", CMD_CONSOLE) == CommandResult::OK);
+    CHECK(run("s x", CMD_CONSOLE) == CommandResult::BAD_ARGS);
+    CHECK(run("set1", CMD_CONSOLE) == CommandResult::OK);
+    CHECK_EQ(args.source, CMD_CONSOLE);
+    CHECK(run("set1", CMD_MQTT) == CommandResult::OK);
+    CHECK_EQ(args.source, CMD_MQTT);
+    // the response of an MQTT 5 request is passed on to the handler
+    auto* response = (const mqtt_response_t*)&args;
+    args.response = response;
+    CHECK(table.run("set1", 4, CMD_MQTT, args) == CommandResult::OK);
+    CHECK(last && last->response == response);
+}
+
+static void testInts() {
+    CHECK_STR(ints("1 30"), "1 30");
+    CHECK_STR(ints("  -5   +7 "), "-5 7");
+    CHECK_STR(ints("-0 007"), "0 7");
+    // int32_t limits
+    CHECK_STR(ints("2147483647 -2147483648"), "2147483647 -2147483648");
+    CHECK_STR(ints("2147483648"), "bad");
+    CHECK_STR(ints("-2147483649"), "bad");
+    CHECK_STR(ints("+2147483648"), "bad");
+    CHECK_STR(ints("99999999999999999999999"), "bad");
+    // signs and digits only
+    CHECK_STR(ints("-"), "bad");
+    CHECK_STR(ints("+"), "bad");
+    CHECK_STR(ints("--1"), "bad");
+    CHECK_STR(ints("+-1"), "bad");
+    CHECK_STR(ints("1-"), "bad");
+    CHECK_STR(ints("1x"), "bad");
+    CHECK_STR(ints("0x10"), "bad");
+    CHECK_STR(ints("1.5"), "bad");
+    CHECK_STR(ints("1,2"), "bad");
+    // count
+    CHECK_STR(ints(""), "bad");
+    CHECK_STR(ints("1 2 3 4"), "1 2 3 4");
+    CHECK_STR(ints("1 2 3 4 5"), "bad");
+    CHECK(run("poll") == CommandResult::OK);
+    CHECK(run("poll 1 2 3") == CommandResult::BAD_ARGS);
+}
+
+static void testHex() {
+    CHECK_STR(hex("82 60 c1"), "82 60 C1");
+    CHECK_STR(hex("8260C1 01"), "82 60 C1 01");
+    CHECK_STR(hex("aA Ff 00"), "AA FF 00");
+    // two digits per byte
+    CHECK_STR(hex("826"), "bad");
+    CHECK_STR(hex("82 6"), "bad");
+    CHECK_STR(hex("8 260"), "bad");
+    CHECK_STR(hex("zz"), "bad");
+    CHECK_STR(hex("0x82"), "bad");
+    CHECK_STR(hex("82 -1"), "bad");
+    CHECK_STR(hex(""), "bad");
+    std::string max;
+    for (int i = 0; i < COMMAND_MAX_BYTES; ++i)
+        max += "5A";
+    CHECK_EQ(hex(max).size(), COMMAND_MAX_BYTES * 3u - 1);
+    CHECK_STR(hex(max + " 00"), "bad");
+}
+
+static void testText() {
+    CHECK(run("filter  drop 82   A401 * ") == CommandResult::OK);
+    CHECK_EQ(args.count, 4u);
+    CHECK_STR(std::string(args.text, args.text_len), "drop 82   A401 *");
+    CHECK(run("filter") == CommandResult::OK);
+    CHECK_EQ(args.count, 0u);
+    CHECK_EQ(args.text_len, 0u);
+    CHECK(run("filter a b c d e f") == CommandResult::BAD_ARGS);
+}
+
+int main() {
+    testNames();
+    testSources();
+    testInts();
+    testHex();
+    testText();
+    return test_result();
+}
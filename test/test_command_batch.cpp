@@ -0,0 +1,93 @@
+#include "command_batch.h"
+#include "test.h"
+#include <cstring>
+#include <string>
+
+static CommandBatch batch;
+
+// Parses s as a batch: "a|b|c" or "error" if it is not a batch or malformed
+static std::string parse(const char* s) {
+    size_t n = strlen(s);
+    if (!CommandBatch::isBatch(s, n) || !batch.parse(s, n))
+        return "error";
+    std::string r;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (i)
+            r += '|';
+        r.append(batch.command(i), batch.length(i));
+        CHECK_EQ(strlen(batch.command(i)), batch.length(i));
+    }
+    return r;
+}
+
+static void testLines() {
+    CHECK_STR(parse("device\nstatus\nset2"), "device|status|set2");
+    CHECK_STR(parse("device\r\nstatus\r\n"), "device|status");
+    CHECK_STR(parse("\n\n  set2 \t\n\n status"), "set2|status");
+    CHECK(!CommandBatch::isBatch("status", 6));
+    CHECK(!CommandBatch::isBatch("filter drop 82", 14));
+    // a single command with a trailing newline (mosquitto_pub -s/-l) or blank lines around it is not a batch
+    CHECK(!CommandBatch::isBatch("status\n", 7));
+    CHECK(!CommandBatch::isBatch("status\r\n", 8));
+    CHECK(!CommandBatch::isBatch("\n\n  set2 \t\n\n", 11));
+    CHECK(!CommandBatch::isBatch("\n", 1));
+    CHECK(!CommandBatch::isBatch("", 0));
+}
+
+static void testTrim() {
+    const char* s = "\n  filter drop 82 \r\n";
+    size_t n = strlen(s);
+    CommandBatch::trim(s, n);
+    CHECK_STR(std::string(s, n), "filter drop 82");
+    s = " \n";
+    n = strlen(s);
+    CommandBatch::trim(s, n);
+    CHECK_EQ(n, 0u);
+}
+
+static void testJson() {
+    CHECK_STR(parse("[\"device\", \"status\",\"set2\"]"), "device|status|set2");
+    CHECK_STR(parse("  [ \"device\" ]  \n"), "device");
+    CHECK_STR(parse("[]"), "");
+    CHECK_STR(parse(" [ ] "), "");
+    CHECK_STR(parse("[\" status \", \"\"]"), "status");
+    CHECK_STR(parse("[\"a\\\"b\\\\c\\/d\\u0041\"]"), "a\"b\\c/dA");
+    // malformed
+    CHECK_STR(parse("[\"a\",]"), "error");
+    CHECK_STR(parse("[\"a\" \"b\"]"), "error");
+    CHECK_STR(parse("[\"a\"] x"), "error");
+    CHECK_STR(parse("[\"a"), "error");
+    CHECK_STR(parse("[\"a\\"), "error");
+    CHECK_STR(parse("[status]"), "error");
+    CHECK_STR(parse("[\"a\\x\"]"), "error");
+    CHECK_STR(parse("[\"a\\u00\"]"), "error");
+    // commands are ASCII, no NUL
+    CHECK_STR(parse("[\"\\u00e9\"]"), "error");
+    CHECK_STR(parse("[\"a\\u0000b\"]"), "error");
+}
+
+static void testLimits() {
+    std::string lines, json = "[";
+    for (int i = 0; i < BATCH_MAX_COMMANDS; ++i) {
+        lines += "ping\n";
+        json += i ? ",\"ping\"" : "\"ping\"";
+    }
+    CHECK_EQ(parse(lines.c_str()).size(), BATCH_MAX_COMMANDS * 5u - 1);
+    CHECK_EQ(parse((json + "]").c_str()).size(), BATCH_MAX_COMMANDS * 5u - 1);
+    CHECK_STR(parse((lines + "ping").c_str()), "error");
+    CHECK_STR(parse((json + ",\"ping\"]").c_str()), "error");
+
+    // the text of all commands, each with its terminator
+    std::string fits(BATCH_MAX_TEXT - 3, 'x');
+    CHECK_EQ(parse(("x\n" + fits).c_str()).size(), (size_t)BATCH_MAX_TEXT - 1); // "x|xx..."
+    CHECK_STR(parse(("x\n" + fits + "x").c_str()), "error");
+    CHECK_STR(parse(("xx\n" + fits).c_str()), "error");
+}
+
+int main() {
+    testLines();
+    testTrim();
+    testJson();
+    testLimits();
+    return test_result();
+}
@@ -0,0 +1,19 @@
+#include "command.h"
+
+// Built by ctest and expected to fail: a duplicate command name in a constexpr CommandTable does not compile.
+// With -DUNIQUE it has to build, so the failure is the duplicate and nothing else.
+
+static bool handler(const CommandArgs& args) { return true; }
+
+static constexpr Command commands[] = {
+    {"status", ArgType::NONE, 0, 0, CMD_ANY, handler, ""},
+    {"poll", ArgType::INT, 0, 2, CMD_ANY, handler, ""},
+#ifdef UNIQUE
+    {"ping", ArgType::NONE, 0, 0, CMD_ANY, handler, ""},
+#else
+    {"status", ArgType::NONE, 0, 0, CMD_ANY, handler, ""},
+#endif
+};
+static constexpr CommandTable table(commands);
+
+int main() { return table.find("poll", 4) ? 0 : 1; }
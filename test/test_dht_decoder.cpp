@@ -0,0 +1,108 @@
+#include "dht_decoder.h"
+#include "test.h"
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// A reading as "rc b0 b1 b2 b3 b4 humidity temperature", the format of the fixtures/dht22_*.expected files
+static std::string decode(DhtDecoder& d, const std::vector<dht_pulse_t>& pulses) {
+    int rc = d.decode(pulses.data(), pulses.size());
+    char buf[64];
+    const uint8_t* b = d.data();
+    snprintf(buf, sizeof(buf), "%d %02X %02X %02X %02X %02X %d %d", rc, b[0], b[1], b[2], b[3], b[4], d.getHumidity(),
+             d.getTemperature());
+    return buf;
+}
+
+// Recorded traces: one pulse per line, "<us> <level>", as the RMT symbols of a read (the level alternates, starting low)
+static void testRecorded(const char* name) {
+    std::ifstream trace(std::string("fixtures/") + name + ".trace"), expected(std::string("fixtures/") + name + ".expected");
+    std::vector<dht_pulse_t> pulses;
+    unsigned us, level;
+    while (trace >> us >> level)
+        pulses.push_back({(uint16_t)us, (uint8_t)level});
+    std::string line;
+    if (pulses.empty() || !std::getline(expected, line)) {
+        printf("%s: no trace\n", name);
+        ++test_failures;
+        return;
+    }
+    DhtDecoder d;
+    CHECK_STR(decode(d, pulses), line);
+}
+
+// A read as the sensor sends it: response, 40 bits, end of the last bit; jitter in us on every pulse
+static std::vector<dht_pulse_t> synthetic(const uint8_t* b, int jitter = 0, bool split = false) {
+    std::vector<dht_pulse_t> v;
+    auto j = [&](int us) { return (uint16_t)(us + (jitter ? rand() % (2 * jitter + 1) - jitter : 0)); };
+    v.push_back({3, 0});     // rest of the start signal
+    v.push_back({j(30), 1}); // released by the host
+    v.push_back({j(80), 0});
+    if (split) {
+        // one level in two symbols and an empty one, as the RMT can report it
+        v.push_back({j(40), 1});
+        v.push_back({0, 0});
+        v.push_back({j(40), 1});
+    } else {
+        v.push_back({j(80), 1});
+    }
+    for (int k = 0; k < 40; k++) {
+        v.push_back({j(50), 0});
+        v.push_back({j((b[k / 8] & (0x80 >> k % 8)) ? 70 : 27), 1});
+    }
+    v.push_back({j(50), 0});
+    v.push_back({0, 1}); // end marker
+    return v;
+}
+
+static void testSynthetic() {
+    DhtDecoder d;
+    const uint8_t reading[5] = {0x02, 0x8C, 0x01, 0x5F, 0xEE};
+    CHECK_STR(decode(d, synthetic(reading)), "0 02 8C 01 5F EE 652 351");
+    CHECK_STR(decode(d, synthetic(reading, 0, true)), "0 02 8C 01 5F EE 652 351");
+
+    // +-8 us on every pulse, a 0 stays below and a 1 above BIT_ONE
+    srand(1);
+    int failed = 0;
+    for (int i = 0; i < 1000; i++)
+        failed += decode(d, synthetic(reading, 8, i & 1)) != "0 02 8C 01 5F EE 652 351";
+    CHECK_EQ(failed, 0);
+
+    // sign bit of the temperature
+    const uint8_t negative[5] = {0x02, 0x8C, 0x80, 0x65, 0x73};
+    CHECK_STR(decode(d, synthetic(negative)), "0 02 8C 80 65 73 652 -101");
+
+    const uint8_t bad_sum[5] = {0x02, 0x8C, 0x01, 0x5F, 0xEF};
+    CHECK_STR(decode(d, synthetic(bad_sum)), "-1 02 8C 01 5F EF 652 351");
+}
+
+static void testErrors() {
+    DhtDecoder d;
+    const uint8_t reading[5] = {0x02, 0x8C, 0x01, 0x5F, 0xEE};
+    auto t = synthetic(reading);
+    CHECK_STR(decode(d, t), "0 02 8C 01 5F EE 652 351");
+    // truncated: the previous reading is kept
+    t.resize(t.size() - 10);
+    CHECK_EQ(d.decode(t.data(), t.size()), DHT_TIMEOUT_ERROR);
+    CHECK_EQ(d.getTemperature(), 351);
+    // no sensor: the line stays high after the start signal
+    dht_pulse_t none[] = {{3, 0}, {0, 1}};
+    CHECK_EQ(d.decode(none, 2), DHT_TIMEOUT_ERROR);
+    CHECK_EQ(d.decode(nullptr, 0), DHT_TIMEOUT_ERROR);
+    // a bit pulse out of range
+    t = synthetic(reading);
+    t[10].us = 150;
+    CHECK_EQ(d.decode(t.data(), t.size()), DHT_TIMEOUT_ERROR);
+    // no valid response
+    t = synthetic(reading);
+    t[2].us = 30;
+    CHECK_EQ(d.decode(t.data(), t.size()), DHT_TIMEOUT_ERROR);
+}
+
+int main() {
+    testRecorded("dht22_recorded");
+    testSynthetic();
+    testErrors();
+    return test_result();
+}
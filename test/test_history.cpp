@@ -0,0 +1,101 @@
+#include "history.h"
+#include "test.h"
+#include <vector>
+
+static History history; // too large for the stack
+
+// Reads the whole range in chunks of `chunk` buckets
+static std::vector<History::entry_t> readAll(int tier, uint32_t from, uint32_t to, size_t chunk) {
+    std::vector<History::entry_t> out;
+    History::entry_t copy[8];
+    size_t cursor = 0, n;
+    while ((n = history.read(tier, from, to, cursor, copy, chunk)) > 0)
+        out.insert(out.end(), copy, copy + n);
+    return out;
+}
+
+static void testBuckets() {
+    history.reset(2);
+    // one sample every 3 s for 2 h
+    for (uint32_t t = 0; t < 7200; t += 3) {
+        int64_t v[2] = {t % 100, -(int64_t)t};
+        history.add(t, v);
+    }
+    CHECK_EQ(history.count(History::TIER_5S), (size_t)HISTORY_5S_LEN);
+    CHECK_EQ(history.count(History::TIER_1M), 119u); // the bucket of the last minute is still open
+    CHECK_EQ(history.count(History::TIER_1H), 1u);
+
+    auto m = readAll(History::TIER_1M, 0, UINT32_MAX, 8);
+    CHECK_EQ(m.size(), 119u);
+    CHECK_EQ(m.front().t, 0u);
+    CHECK_EQ(m.back().t, 7080u);
+    // 0, 3, .., 57
+    CHECK_EQ(m[0].min[0], 0);
+    CHECK_EQ(m[0].max[0], 57);
+    CHECK_EQ(m[0].avg[0], 28);
+    CHECK_EQ(m[0].min[1], -57);
+    CHECK_EQ(m[1].min[1], -117);
+
+    // the 5 s tier only keeps the last 10 min
+    auto s = readAll(History::TIER_5S, 0, UINT32_MAX, 3);
+    CHECK_EQ(s.size(), (size_t)HISTORY_5S_LEN);
+    CHECK_EQ(s.front().t, 7195u - 5 * HISTORY_5S_LEN);
+    for (size_t i = 1; i < s.size(); ++i)
+        CHECK_EQ(s[i].t, s[i - 1].t + 5);
+}
+
+static void testRange() {
+    auto r = readAll(History::TIER_1M, 600, 1200, 1);
+    CHECK_EQ(r.size(), 11u);
+    CHECK_EQ(r.front().t, 600u);
+    CHECK_EQ(r.back().t, 1200u);
+    // bucket starts, not sample times
+    r = readAll(History::TIER_1M, 601, 659, 4);
+    CHECK_EQ(r.size(), 0u);
+    r = readAll(History::TIER_1M, 7000, UINT32_MAX, 4);
+    CHECK_EQ(r.size(), 2u);
+}
+
+static void testCursor() {
+    // buckets added between reads are picked up, overwritten ones skipped
+    history.reset(1);
+    int64_t v = 1;
+    for (uint32_t t = 0; t < 60; t += 5)
+        history.add(t, &v);
+    History::entry_t copy[4];
+    size_t cursor = 0;
+    CHECK_EQ(history.read(History::TIER_5S, 0, UINT32_MAX, cursor, copy, 4), 4u);
+    CHECK_EQ(copy[3].t, 15u);
+    for (uint32_t t = 60; t < 60 + 5 * HISTORY_5S_LEN; t += 5)
+        history.add(t, &v);
+    CHECK_EQ(history.read(History::TIER_5S, 0, UINT32_MAX, cursor, copy, 1), 1u);
+    CHECK_EQ(copy[0].t, 55u); // 20..50 were overwritten, 55 is the oldest still in the ring
+    // reset while reading
+    history.reset(1);
+    CHECK_EQ(history.read(History::TIER_5S, 0, UINT32_MAX, cursor, copy, 4), 0u);
+    history.add(1000, &v);
+    history.add(1005, &v);
+    CHECK_EQ(history.read(History::TIER_5S, 0, UINT32_MAX, cursor, copy, 4), 1u);
+    CHECK_EQ(copy[0].t, 1000u);
+}
+
+static void testInt64() {
+    history.reset(1);
+    int64_t big = 5000000000LL, neg = -5000000000LL;
+    history.add(0, &big);
+    history.add(1, &neg);
+    history.add(5, &big);
+    auto e = readAll(History::TIER_5S, 0, UINT32_MAX, 4);
+    CHECK_EQ(e.size(), 1u);
+    CHECK_EQ(e[0].max[0], 5000000000LL);
+    CHECK_EQ(e[0].min[0], -5000000000LL);
+    CHECK_EQ(e[0].avg[0], 0);
+}
+
+int main() {
+    testBuckets();
+    testRange();
+    testCursor();
+    testInt64();
+    return test_result();
+}
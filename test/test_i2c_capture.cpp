@@ -0,0 +1,161 @@
+#include "i2c_capture.h"
+#include "i2c_decoder.h"
+#include "test.h"
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// The I2C edge traces of test_i2c_decoder (240 CPU cycles per us) as the RMT would capture them at 1 us resolution
+#define TICKS_PER_US 240
+
+struct line_t {
+    uint32_t first = 0; // us of the first edge, from the first edge of the trace
+    std::vector<uint32_t> symbols;
+};
+
+static uint32_t symbol(uint32_t d0, uint32_t l0, uint32_t d1, uint32_t l1) { return d0 | l0 << 15 | d1 << 16 | l1 << 31; }
+
+// Splits the trace into the RMT symbols of SCL and SDA, each starting at its own first edge
+static bool loadLines(const std::string& path, line_t& scl, line_t& sda) {
+    std::ifstream in(path);
+    uint32_t tick, t0 = 0;
+    std::string levels;
+    std::vector<uint32_t> edges[2];
+    while (in >> tick >> levels) {
+        if (edges[0].empty() && edges[1].empty())
+            t0 = tick;
+        uint32_t us = (tick - t0) / TICKS_PER_US;
+        for (int i = 0; i < 2; ++i) {
+            if ((levels[i] == '1') == (edges[i].size() % 2 == 1))
+                edges[i].push_back(us);
+        }
+    }
+    line_t* out[2] = {&scl, &sda};
+    for (int i = 0; i < 2; ++i) {
+        auto& e = edges[i];
+        out[i]->first = e.empty() ? 0 : e[0];
+        // pairs of low/high levels; the last level has no end, a zero duration
+        for (size_t k = 0; k < e.size(); k += 2)
+            out[i]->symbols.push_back(symbol(e[k + 1 < e.size() ? k + 1 : k] - e[k], 0, k + 2 < e.size() ? e[k + 2] - e[k + 1] : 0, 1));
+    }
+    return !edges[0].empty() && !edges[1].empty();
+}
+
+static std::string formatEvent(const sniffer_event_t& ev) {
+    char buf[64];
+    if (ev.data & I2cDecoder::STOP)
+        snprintf(buf, sizeof(buf), "%u %u STOP", ev.tm, ev.dt);
+    else
+        snprintf(buf, sizeof(buf), "%u %u %s%02X %s", ev.tm, ev.dt, (ev.data & I2cDecoder::START) ? "START " : "", ev.data & 0xFF,
+                 (ev.data & I2cDecoder::ACK) ? "ACK" : "NACK");
+    return buf;
+}
+
+static std::vector<uint32_t> edgesOf(const line_t& line) {
+    std::vector<uint32_t> edges(line.symbols.size() * 2);
+    edges.resize(I2cCapture::edges(line.symbols.data(), line.symbols.size(), edges.data(), edges.size()));
+    return edges;
+}
+
+static std::vector<std::string> decode(const std::vector<uint32_t>& sda, const std::vector<uint32_t>& scl, uint32_t offset) {
+    std::vector<uint32_t> ticks(sda.size() + scl.size());
+    std::vector<uint8_t> lines(ticks.size());
+    size_t n = I2cCapture::merge(sda.data(), sda.size(), scl.data(), scl.size(), offset, ticks.data(), lines.data(), ticks.size());
+    CHECK_EQ(n, ticks.size());
+    std::vector<sniffer_event_t> events(n);
+    I2cDecoder decoder(1);
+    events.resize(decoder.decode(ticks.data(), lines.data(), n, events.data(), n));
+    std::vector<std::string> res;
+    for (const auto& ev : events)
+        res.push_back(formatEvent(ev));
+    return res;
+}
+
+// Aligned in a +-50 us window around the true offset, the captures decode to the events of the edge trace
+static void testFixture(const char* name, size_t errors_expected = 0) {
+    line_t scl, sda;
+    if (!loadLines(std::string("fixtures/") + name + ".trace", scl, sda)) {
+        printf("%s: no trace\n", name);
+        ++test_failures;
+        return;
+    }
+    auto sda_edges = edgesOf(sda), scl_edges = edgesOf(scl);
+    uint32_t truth = scl.first - sda.first, offset;
+    size_t errors = I2cCapture::align(sda_edges.data(), sda_edges.size(), scl_edges.data(), scl_edges.size(), truth > 50 ? truth - 50 : 0,
+                                      truth + 50, offset);
+    CHECK_EQ(errors, errors_expected);
+    CHECK(offset + 1 >= truth && offset <= truth + 1);
+    // the START is at 0, the frames' times shift with the offset error
+    std::ifstream expected(std::string("fixtures/") + name + ".expected");
+    auto events = decode(sda_edges, scl_edges, truth);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(expected, line);)
+        lines.push_back(line);
+    CHECK_EQ(events.size(), lines.size());
+    for (size_t i = 0; i < events.size() && i < lines.size(); ++i)
+        CHECK_STR(events[i], lines[i]);
+    CHECK_EQ(decode(sda_edges, scl_edges, offset).size(), events.size());
+}
+
+// Off by a clock period (10 us) data changes come while SCL is high, or SCL clocks before the START
+static void testPeriodShift() {
+    line_t scl, sda;
+    CHECK(loadLines("fixtures/itho_write.trace", scl, sda));
+    auto sda_edges = edgesOf(sda), scl_edges = edgesOf(scl);
+    uint32_t truth = scl.first - sda.first, offset;
+    CHECK(I2cCapture::align(sda_edges.data(), sda_edges.size(), scl_edges.data(), scl_edges.size(), truth + 8, truth + 12, offset) > 0);
+    CHECK(I2cCapture::align(sda_edges.data(), sda_edges.size(), scl_edges.data(), scl_edges.size(), 0, truth - 4, offset) > 0);
+}
+
+// The SCL channel ended between the two frames: each part is aligned on its own, together they decode both frames
+static void testSplitScl() {
+    line_t scl, sda;
+    CHECK(loadLines("fixtures/itho_write.trace", scl, sda));
+    auto sda_edges = edgesOf(sda), scl_edges = edgesOf(scl);
+    uint32_t truth = scl.first - sda.first;
+    size_t split = 2; // after the longest high level, the gap between the frames
+    for (size_t i = 3; i + 1 < scl_edges.size(); i += 2) {
+        if (scl_edges[i + 1] - scl_edges[i] > scl_edges[split] - scl_edges[split - 1])
+            split = i + 1;
+    }
+    std::vector<uint32_t> first(scl_edges.begin(), scl_edges.begin() + split), second;
+    for (size_t i = split; i < scl_edges.size(); ++i)
+        second.push_back(scl_edges[i] - scl_edges[split]);
+    uint32_t o1, o2, truth2 = truth + scl_edges[split];
+    I2cCapture::align(sda_edges.data(), sda_edges.size(), first.data(), first.size(), 0, truth + 50, o1);
+    I2cCapture::align(sda_edges.data(), sda_edges.size(), second.data(), second.size(), truth2 - 50, truth2 + 50, o2);
+    CHECK(o1 + 1 >= truth && o1 <= truth + 1);
+    CHECK(o2 + 1 >= truth2 && o2 <= truth2 + 1);
+    std::vector<uint32_t> merged;
+    for (uint32_t t : first)
+        merged.push_back(t + o1);
+    for (uint32_t t : second)
+        merged.push_back(t + o2);
+    auto events = decode(sda_edges, merged, 0);
+    CHECK_EQ(events.size(), 17u); // 7 + 8 bytes, 2 STOPs
+}
+
+// A high level before the first edge is the idle line, a zero duration the level the capture ended at
+static void testEdges() {
+    uint32_t symbols[] = {symbol(100, 1, 5, 0), symbol(5, 1, 7, 0), symbol(3, 1, 0, 0), symbol(9, 0, 9, 1)};
+    uint32_t edges[8];
+    size_t n = I2cCapture::edges(symbols, 4, edges, 8);
+    CHECK_EQ(n, 5u);
+    CHECK_EQ(edges[0], 0u);
+    CHECK_EQ(edges[1], 5u);
+    CHECK_EQ(edges[2], 10u);
+    CHECK_EQ(edges[3], 17u);
+    CHECK_EQ(edges[4], 20u);
+    CHECK_EQ(I2cCapture::edges(symbols, 4, edges, 2), 2u);
+}
+
+int main() {
+    // at 1 us resolution the RMT can't resolve 400 kHz (1.25 us per level), so no wrap_400khz
+    testFixture("itho_write");
+    testFixture("read_nack");
+    testFixture("truncated", 1); // the START in the middle of a byte
+    testPeriodShift();
+    testSplitScl();
+    testEdges();
+    return test_result();
+}
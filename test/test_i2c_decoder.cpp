@@ -0,0 +1,90 @@
+#include "i2c_decoder.h"
+#include "test.h"
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// Edge traces made by fixtures/make_i2c_traces.py, 240 CPU cycles per us as on the ESP32
+#define TICKS_PER_US 240
+
+struct trace_t {
+    std::vector<uint32_t> ticks;
+    std::vector<uint8_t> lines;
+};
+
+static bool loadTrace(const std::string& path, trace_t& trace) {
+    std::ifstream in(path);
+    uint32_t tick;
+    std::string levels;
+    while (in >> tick >> levels) {
+        trace.ticks.push_back(tick);
+        trace.lines.push_back((levels[0] == '1' ? I2cDecoder::LINE_SCL : 0) | (levels[1] == '1' ? I2cDecoder::LINE_SDA : 0));
+    }
+    return !trace.ticks.empty();
+}
+
+static std::string formatEvent(const sniffer_event_t& ev) {
+    char buf[64];
+    if (ev.data & I2cDecoder::STOP)
+        snprintf(buf, sizeof(buf), "%u %u STOP", ev.tm, ev.dt);
+    else
+        snprintf(buf, sizeof(buf), "%u %u %s%02X %s", ev.tm, ev.dt, (ev.data & I2cDecoder::START) ? "START " : "", ev.data & 0xFF,
+                 (ev.data & I2cDecoder::ACK) ? "ACK" : "NACK");
+    return buf;
+}
+
+static void testFixture(const char* name) {
+    trace_t trace;
+    if (!loadTrace(std::string("fixtures/") + name + ".trace", trace)) {
+        printf("%s: no trace\n", name);
+        ++test_failures;
+        return;
+    }
+    std::ifstream expected(std::string("fixtures/") + name + ".expected");
+    std::vector<sniffer_event_t> events(trace.ticks.size());
+    I2cDecoder decoder(TICKS_PER_US);
+    events.resize(decoder.decode(trace.ticks.data(), trace.lines.data(), trace.ticks.size(), events.data(), events.size()));
+    std::string line;
+    size_t i = 0;
+    while (std::getline(expected, line)) {
+        if (i >= events.size()) {
+            printf("%s: missing event '%s'\n", name, line.c_str());
+            ++test_failures;
+            return;
+        }
+        CHECK_STR(formatEvent(events[i++]), line);
+    }
+    CHECK_EQ(i, events.size());
+}
+
+// After lost edges the sniffer resets the decoder with the current levels: the rest of the frame is ignored up to the next START
+static void testLostEdges() {
+    trace_t trace;
+    CHECK(loadTrace("fixtures/itho_write.trace", trace));
+    I2cDecoder decoder(TICKS_PER_US);
+    sniffer_event_t ev;
+    size_t events = 0, i = 0;
+    for (; i < 40; ++i) // START, the address byte and a few bits of the next one
+        events += decoder.feed(trace.ticks[i], trace.lines[i], ev);
+    CHECK_EQ(events, 1u);
+    i += 3; // lost
+    decoder.reset(trace.lines[i++]);
+    bool first = true;
+    for (; i < trace.ticks.size(); ++i) {
+        if (decoder.feed(trace.ticks[i], trace.lines[i], ev)) {
+            if (first) {
+                CHECK_STR(formatEvent(ev), "830 90 START 80 ACK"); // the second frame
+                first = false;
+            }
+            ++events;
+        }
+    }
+    CHECK_EQ(events, 1u + 9); // 8 bytes and STOP of the second frame
+}
+
+int main() {
+    for (const char* name : {"itho_write", "read_nack", "truncated", "wrap_400khz"})
+        testFixture(name);
+    testLostEdges();
+    return test_result();
+}
@@ -0,0 +1,59 @@
+#include "itho_reply.h"
+#include "test.h"
+#include "util.h"
+
+static int calls;
+static size_t last_len;
+static uint8_t last_first;
+static void handler(const uint8_t* payload, size_t len) {
+    ++calls;
+    last_len = len;
+    last_first = len ? payload[0] : 0;
+}
+
+static size_t makeFrame(uint8_t* frame, uint16_t code, uint8_t flags, size_t plen) {
+    frame[0] = 0x80, frame[1] = 0x82, frame[2] = code >> 8, frame[3] = code & 0xFF, frame[4] = flags, frame[5] = plen;
+    for (size_t i = 0; i < plen; ++i)
+        frame[ITHO_REPLY_HEADER_LEN + i] = 0x10 + i;
+    size_t len = ITHO_REPLY_HEADER_LEN + plen + 1;
+    fixChecksum(frame, len);
+    return len;
+}
+
+int main() {
+    CHECK(itho_reply_register(0xA401, ITHO_REPLY_FLAGS, handler));
+    CHECK(itho_reply_register(0xA401, ITHO_REPLY_FLAGS, handler)); // replaces, doesn't take a second slot
+    for (int i = 1; i < ITHO_REPLY_MAX_HANDLERS; ++i)
+        CHECK(itho_reply_register(0x1000 + i, ITHO_REPLY_FLAGS, handler));
+    CHECK(!itho_reply_register(0x2000, ITHO_REPLY_FLAGS, handler));
+
+    uint8_t frame[64];
+    size_t len = makeFrame(frame, 0xA401, ITHO_REPLY_FLAGS, 3);
+    CHECK_EQ(itho_reply_dispatch(frame, len), ITHO_REPLY_HANDLED);
+    CHECK_EQ(calls, 1);
+    CHECK_EQ(last_len, 3u);
+    CHECK_EQ(last_first, 0x10);
+
+    // the flags are part of the key
+    len = makeFrame(frame, 0xA401, 0x02, 3);
+    CHECK_EQ(itho_reply_dispatch(frame, len), ITHO_REPLY_UNKNOWN);
+    len = makeFrame(frame, 0xA400, ITHO_REPLY_FLAGS, 0);
+    CHECK_EQ(itho_reply_dispatch(frame, len), ITHO_REPLY_UNKNOWN);
+
+    len = makeFrame(frame, 0xA401, ITHO_REPLY_FLAGS, 3);
+    frame[len - 1] ^= 1;
+    CHECK_EQ(itho_reply_dispatch(frame, len), ITHO_REPLY_BAD_CHECKSUM);
+
+    len = makeFrame(frame, 0xA401, ITHO_REPLY_FLAGS, 3);
+    CHECK_EQ(itho_reply_dispatch(frame, len - 1), ITHO_REPLY_MALFORMED); // length byte exceeds the frame
+    CHECK_EQ(itho_reply_dispatch(frame, ITHO_REPLY_HEADER_LEN), ITHO_REPLY_MALFORMED);
+    frame[1] = 0x84;
+    CHECK_EQ(itho_reply_dispatch(frame, len), ITHO_REPLY_MALFORMED);
+    CHECK_EQ(calls, 1);
+
+    // trailing bytes after the checksum are ignored
+    len = makeFrame(frame, 0xA401, ITHO_REPLY_FLAGS, 3);
+    CHECK_EQ(itho_reply_dispatch(frame, len + 2), ITHO_REPLY_HANDLED);
+    CHECK_EQ(calls, 2);
+    return test_result();
+}
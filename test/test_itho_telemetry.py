@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""
+Checks tools/itho_telemetry.py against the firmware encoder: decodes fixtures/telemetry.bin (the encoding test_telemetry
+checks TelemetryEncoder against) back into fixtures/telemetry.samples, re-encodes them and compares the CSV output.
+
+After changing telemetry.samples, regenerate the other fixtures with --update and check them with test_telemetry.
+"""
+import io
+import os
+import sys
+from contextlib import redirect_stdout
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+import itho_telemetry  # noqa: E402
+
+FIXTURES = os.path.join(os.path.dirname(os.path.abspath(__file__)), "fixtures")
+
+
+def read_samples():
+    batches = []
+    with open(os.path.join(FIXTURES, "telemetry.samples")) as f:
+        for line in f:
+            fields = line.split()
+            if not fields or fields[0].startswith("#"):
+                continue
+            if fields[0] == "decimals":
+                batches.append(([int(x) for x in fields[1:]], []))
+            else:
+                batches[-1][1].append((int(fields[0]), [int(x) for x in fields[1:]]))
+    return batches
+
+
+def csv_output(path):
+    out = io.StringIO()
+    sys.argv = ["itho_telemetry.py", path]
+    with redirect_stdout(out), open(itho_telemetry.__file__) as f:
+        exec(compile(f.read(), itho_telemetry.__file__, "exec"), {"__name__": "__main__"})
+    return out.getvalue()
+
+
+def main():
+    batches = read_samples()
+    bin_path = os.path.join(FIXTURES, "telemetry.bin")
+    csv_path = os.path.join(FIXTURES, "telemetry.csv")
+    encoded = b"".join(itho_telemetry.encode_batch(d, s) for d, s in batches)
+    if "--update" in sys.argv:
+        with open(bin_path, "wb") as f:
+            f.write(encoded)
+        with open(csv_path, "w") as f:
+            f.write(csv_output(bin_path))
+        return 0
+
+    failures = 0
+
+    def check(cond, what):
+        nonlocal failures
+        if not cond:
+            print(f"failed: {what}")
+            failures += 1
+
+    with open(bin_path, "rb") as f:
+        data = f.read()
+    check(list(itho_telemetry.decode_stream(data)) == batches, "decode telemetry.bin == telemetry.samples")
+    check(encoded == data, "encode telemetry.samples == telemetry.bin")
+    with open(csv_path) as f:
+        check(csv_output(bin_path) == f.read(), "itho_telemetry.py telemetry.bin == telemetry.csv")
+    check(itho_telemetry.format_value(-5, 2) == "-0.05", "format_value(-5, 2)")
+    print(f"{failures} check(s) failed" if failures else "ok")
+    return failures != 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
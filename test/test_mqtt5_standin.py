@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+Checks tools/mqtt5_standin.py, the broker the firmware's MQTT 5 mode is tested against: the Topic Alias Maximum in the
+CONNACK, aliases resolved for the subscribers and only valid on their connection, and the DISCONNECT reasons for aliases
+the firmware must not send (above the maximum, or not set on this connection).
+"""
+import asyncio
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+import mqtt5_standin as mqtt  # noqa: E402
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print(f"failed: {what}")
+        failures += 1
+
+
+class Client:
+    """Raw MQTT 5 client, publishing like the firmware: the topic with the first use of an alias, then an empty one."""
+
+    async def connect(self, port, client_id):
+        self.reader, self.writer = await asyncio.open_connection("127.0.0.1", port)
+        body = mqtt.encode_str("MQTT") + bytes([5, 0x02]) + struct.pack(">H", 60) + mqtt.encode_properties([])
+        self.send(mqtt.CONNECT, 0, body + mqtt.encode_str(client_id))
+        kind, _, body = await self.read()
+        check(kind == mqtt.CONNACK and body[1] == 0, "CONNACK success")
+        props, _ = mqtt.decode_properties(body, 2)
+        return dict(props).get(mqtt.TOPIC_ALIAS_MAXIMUM, 0)
+
+    def send(self, kind, flags, body):
+        self.writer.write(mqtt.packet(kind, flags, body))
+
+    async def read(self):
+        return await asyncio.wait_for(mqtt.read_packet(self.reader), 2)
+
+    async def subscribe(self, topic_filter):
+        self.send(mqtt.SUBSCRIBE, 2, struct.pack(">H", 1) + mqtt.encode_properties([]) + mqtt.encode_str(topic_filter) + b"\0")
+        kind, _, body = await self.read()
+        check(kind == mqtt.SUBACK and body[-1] == 0, f"SUBACK {topic_filter}")
+
+    def publish(self, topic, payload, props=()):
+        self.writer.write(mqtt.publish_packet(topic, payload, props))
+
+    async def received(self):
+        """Next PUBLISH as (topic, properties as a dict, payload)."""
+        kind, flags, body = await self.read()
+        check(kind == mqtt.PUBLISH, "PUBLISH forwarded")
+        topic, _, _, props, payload = mqtt.decode_publish(flags, body)
+        return topic, dict(props), payload
+
+    async def disconnect_reason(self):
+        p = await self.read()
+        check(p is not None and p[0] == mqtt.DISCONNECT, "DISCONNECT from the broker")
+        return p[2][0] if p else None
+
+    async def close(self):
+        self.writer.close()
+        await self.writer.wait_closed()
+
+
+async def run():
+    log = []
+    broker = mqtt.Broker(topic_alias_max=2, log=log.append)
+    port = await broker.start("127.0.0.1", 0)
+
+    sub = Client()
+    await sub.connect(port, "sub")
+    await sub.subscribe("itho/+/status")
+    await sub.subscribe("itho/dev/#")
+
+    dev = Client()
+    check(await dev.connect(port, "dev") == 2, "CONNACK Topic Alias Maximum 2")
+    dev.publish("itho/dev/status", b"[1]", [(mqtt.MESSAGE_EXPIRY, 60), (mqtt.TOPIC_ALIAS, 1)])
+    dev.publish("", b"[2]", [(mqtt.MESSAGE_EXPIRY, 55), (mqtt.TOPIC_ALIAS, 1)])
+    dev.publish("itho/dev/data", b"pong", [(mqtt.CORRELATION_DATA, b"\x01\x02")])
+    for payload, expiry in ((b"[1]", 60), (b"[2]", 55)):
+        topic, props, data = await sub.received()  # once, though both subscriptions match
+        check(topic == "itho/dev/status" and data == payload, f"alias 1 resolved for {payload}")
+        check(mqtt.TOPIC_ALIAS not in props, "alias not forwarded")
+        check(props.get(mqtt.MESSAGE_EXPIRY) == expiry, "message expiry forwarded")
+    topic, props, data = await sub.received()
+    check(topic == "itho/dev/data" and props.get(mqtt.CORRELATION_DATA) == b"\x01\x02", "correlation data forwarded")
+    check("dev itho/dev/status 3 bytes alias=1 expiry=55" in log, "publish logged with alias and expiry")
+
+    # above the Topic Alias Maximum
+    dev.publish("itho/dev/dht", b"{}", [(mqtt.TOPIC_ALIAS, 3)])
+    check(await dev.disconnect_reason() == mqtt.TOPIC_ALIAS_INVALID, "alias 3 > 2: Topic Alias invalid")
+    await dev.close()
+
+    # aliases don't survive the connection
+    dev = Client()
+    await dev.connect(port, "dev")
+    dev.publish("", b"[3]", [(mqtt.TOPIC_ALIAS, 1)])
+    check(await dev.disconnect_reason() == mqtt.PROTOCOL_ERROR, "alias 1 not set on the new connection: Protocol Error")
+    await dev.close()
+
+    # without a Topic Alias Maximum in the CONNACK no alias is allowed
+    broker.topic_alias_max = 0
+    dev = Client()
+    check(await dev.connect(port, "dev") == 0, "no Topic Alias Maximum")
+    dev.publish("itho/dev/status", b"[4]", [(mqtt.TOPIC_ALIAS, 1)])
+    check(await dev.disconnect_reason() == mqtt.TOPIC_ALIAS_INVALID, "alias 1 > 0: Topic Alias invalid")
+    await dev.close()
+
+    check(mqtt.topic_matches("itho/+/status", "itho/a/status"), "+ matches a level")
+    check(not mqtt.topic_matches("itho/+", "itho/a/status"), "+ matches one level")
+    check(mqtt.topic_matches("itho/#", "itho"), "# matches the parent")
+
+    await sub.close()
+    broker.close()
+
+
+def main():
+    asyncio.run(run())
+    print(f"{failures} check(s) failed" if failures else "ok")
+    return failures != 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
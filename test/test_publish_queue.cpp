@@ -0,0 +1,159 @@
+#include "publish_queue.h"
+#include "test.h"
+#include <cstring>
+#include <string>
+
+static PublishQueue queue; // too large for the stack
+
+static void pushState(const char* topic, const char* data) { queue.push_state(topic, data, strlen(data), 0); }
+static void push(const char* topic, const char* data) { queue.push(topic, data, strlen(data)); }
+
+// Pops everything as "topic=data topic=data ..."
+static std::string popAll() {
+    std::string s;
+    PublishQueue::message_t m;
+    while (queue.pop(m)) {
+        if (!s.empty())
+            s += ' ';
+        s += m.topic;
+        s += '=';
+        s.append(m.data, m.len);
+    }
+    return s;
+}
+
+static void testKeyframeOrder() {
+    // live: each keyframe is followed by its own deltas
+    pushState("status", "K1");
+    push("delta", "D1");
+    push("delta", "D2");
+    CHECK_STR(popAll(), "status=K1 delta=D1 delta=D2");
+    push("delta", "D3");
+    pushState("status", "K2");
+    push("delta", "D4");
+    CHECK_STR(popAll(), "delta=D3 status=K2 delta=D4");
+
+    // offline: a replaced keyframe is sent at the position of the newer one, after the deltas queued before it
+    pushState("status", "K3");
+    push("delta", "D5");
+    pushState("dht", "H1");
+    pushState("status", "K4");
+    push("delta", "D6");
+    push("data", "E1");
+    pushState("dht", "H2");
+    CHECK_STR(popAll(), "delta=D5 status=K4 delta=D6 data=E1 dht=H2");
+    CHECK_EQ(queue.stats().coalesced, 2u);
+    CHECK_EQ(queue.count(), 0u);
+    CHECK_EQ(queue.bytes(), 0u);
+}
+
+static void testSupersede() {
+    // replay after a reconnect: the deltas to a replaced keyframe are dropped, the newest keyframe is followed by its own
+    uint32_t superseded = queue.stats().superseded;
+    queue.push_state("status", "K1", 2, 0, "delta");
+    push("delta", "D1");
+    push("data", "E1");
+    push("delta", "D2");
+    queue.push_state("status", "K2", 2, 0, "delta");
+    push("delta", "D3");
+    push("delta", "D4");
+    CHECK_STR(popAll(), "data=E1 status=K2 delta=D3 delta=D4");
+    CHECK_EQ(queue.stats().superseded, superseded + 2);
+
+    // live: deltas sent before the next keyframe is queued are not affected, nor are those queued after it
+    queue.push_state("status", "K3", 2, 0, "delta");
+    push("delta", "D5");
+    CHECK_STR(popAll(), "status=K3 delta=D5");
+    push("delta", "D6");
+    queue.push_state("status", "K4", 2, 0, "delta");
+    push("delta", "D7");
+    CHECK_STR(popAll(), "status=K4 delta=D7");
+    CHECK_EQ(queue.stats().superseded, superseded + 3);
+}
+
+static void testEviction() {
+    char data[1000];
+    memset(data, 'x', sizeof(data));
+    pushState("status", "K");
+    size_t pushed = 0;
+    for (; pushed < 40; ++pushed) {
+        snprintf(data, sizeof(data), "%zu", pushed);
+        data[strlen(data)] = 'x';
+        queue.push("delta", data, sizeof(data));
+    }
+    uint32_t evicted = queue.stats().evicted;
+    CHECK(evicted > 0);
+    CHECK_EQ(queue.count(), 1 + pushed - evicted);
+    CHECK(queue.bytes() <= MQTT_QUEUE_SIZE + 1);
+    // the state message stays and is still the oldest, the remaining events are the newest in order
+    PublishQueue::message_t m;
+    CHECK(queue.pop(m));
+    CHECK(m.state);
+    size_t expected = evicted;
+    while (queue.pop(m)) {
+        CHECK(!m.state);
+        CHECK_EQ((size_t)atoi(std::string(m.data, 4).c_str()), expected++);
+        CHECK_EQ(m.len, sizeof(data));
+    }
+    CHECK_EQ(expected, pushed);
+}
+
+static void testLimits() {
+    uint32_t dropped = queue.stats().dropped;
+    static char big[MQTT_MAX_MESSAGE + 1];
+    CHECK(!queue.push("delta", big, sizeof(big)));
+    CHECK(!queue.push("", "x", 1));
+    CHECK(!queue.push_state("s", big, sizeof(big), 0));
+    for (int i = 0; i < MQTT_STATE_SLOTS; ++i)
+        CHECK(queue.push_state(std::to_string(i).c_str(), "x", 1, i));
+    CHECK(!queue.push_state("another", "x", 1, 0));
+    CHECK_EQ(queue.stats().dropped, dropped + 4);
+    PublishQueue::message_t m;
+    CHECK(queue.pop(m));
+    CHECK_STR(m.topic, "0");
+    CHECK_EQ(m.time, 0);
+    CHECK(queue.pop(m));
+    CHECK_EQ(m.time, 1);
+    CHECK(queue.push_state("another", "x", 1, 0)); // a slot is free again
+    CHECK_STR(popAll(), "2=x another=x");
+
+    // correlation data travels with the message
+    const uint8_t corr[] = {1, 2, 3};
+    CHECK(queue.push("reply/to", "ok", 2, corr, sizeof(corr)));
+    CHECK(queue.pop(m));
+    CHECK_STR(m.topic, "reply/to");
+    CHECK_EQ(m.correlation_len, 3u);
+    CHECK(memcmp(m.correlation, corr, 3) == 0);
+}
+
+static void testWrap() {
+    // records wrap around the end of the ring many times, interleaved with state messages
+    char data[300];
+    int next_push = 0, next_pop = 0;
+    for (int round = 0; round < 500; ++round) {
+        for (int i = 0; i < 3; ++i) {
+            int n = snprintf(data, sizeof(data), "%d", next_push++);
+            queue.push("event", data, n + (next_push % 7) * 37);
+        }
+        if (round % 5 == 0)
+            pushState("status", "S");
+        PublishQueue::message_t m;
+        for (int i = 0; i < 3 && queue.pop(m);) {
+            if (m.state)
+                continue;
+            CHECK_EQ(atoi(std::string(m.data, m.len).c_str()), next_pop++);
+            ++i;
+        }
+    }
+    CHECK_EQ(next_pop, next_push);
+    CHECK_EQ(queue.count(), 0u);
+}
+
+int main() {
+    testKeyframeOrder();
+    testSupersede();
+    testEviction();
+    testLimits();
+    testWrap();
+    return test_result();
+}
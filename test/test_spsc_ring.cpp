@@ -0,0 +1,74 @@
+#include "spsc_ring.h"
+#include "test.h"
+#include <atomic>
+#include <thread>
+
+struct record_t {
+    uint32_t seq;
+    uint32_t payload;
+};
+
+static void testSingleThread() {
+    SpscRing<record_t, 8> ring;
+    record_t out[16];
+    CHECK(ring.empty());
+    CHECK_EQ(ring.pop(out, 16), 0u);
+    for (uint32_t i = 0; i < 8; ++i)
+        CHECK(ring.push({i, i * 3}));
+    CHECK_EQ(ring.size(), 8u);
+    CHECK(!ring.push({8, 0})); // full: dropped and counted
+    CHECK_EQ(ring.overflows(), 1u);
+    CHECK_EQ(ring.pop(out, 3), 3u);
+    CHECK_EQ(out[0].seq, 0u);
+    CHECK_EQ(out[2].seq, 2u);
+    // wrap around the end of the buffer
+    for (uint32_t i = 8; i < 11; ++i)
+        CHECK(ring.push({i, i * 3}));
+    CHECK_EQ(ring.pop(out, 16), 8u);
+    for (uint32_t i = 0; i < 8; ++i) {
+        CHECK_EQ(out[i].seq, i + 3);
+        CHECK_EQ(out[i].payload, (i + 3) * 3);
+    }
+    CHECK(ring.empty());
+    CHECK_EQ(ring.overflows(), 1u);
+}
+
+// Producer and consumer threads: everything pushed arrives once and in order, pushes into a full ring are counted
+static void testTwoThreads() {
+    static SpscRing<record_t, 256> ring;
+    const uint32_t total = 200000;
+    std::atomic<uint32_t> pushed{0};
+    std::thread producer([&] {
+        for (uint32_t i = 0; i < total; ++i) {
+            if (ring.push({i, ~i}))
+                pushed.fetch_add(1, std::memory_order_relaxed);
+            if (i % 64 == 0)
+                std::this_thread::yield(); // let the consumer in on single core hosts
+        }
+    });
+    uint32_t received = 0, next = 0, bad = 0;
+    record_t out[32];
+    while (true) {
+        bool done = pushed.load() + ring.overflows() == total;
+        size_t n = ring.pop(out, 32);
+        if (!n && done)
+            break;
+        for (size_t i = 0; i < n; ++i) {
+            if (out[i].seq < next || out[i].payload != ~out[i].seq)
+                ++bad;
+            next = out[i].seq + 1;
+        }
+        received += n;
+    }
+    producer.join();
+    CHECK_EQ(bad, 0u);
+    CHECK_EQ(received, pushed.load());
+    CHECK(received > 0);
+    CHECK_EQ(pushed + ring.overflows(), total);
+}
+
+int main() {
+    testSingleThread();
+    testTwoThreads();
+    return test_result();
+}
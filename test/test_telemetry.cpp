@@ -0,0 +1,94 @@
+#include "telemetry.h"
+#include "test.h"
+#include "util.h"
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// Encodes fixtures/telemetry.samples and compares with the encoding and CSV output of tools/itho_telemetry.py
+// (fixtures/telemetry.bin and .csv, checked from the Python side by test_itho_telemetry.py)
+
+struct Sample {
+    uint32_t t;
+    std::vector<int64_t> values;
+};
+struct Batch {
+    std::vector<uint8_t> decimals;
+    std::vector<Sample> samples;
+};
+
+static std::vector<Batch> readSamples(const char* path) {
+    std::vector<Batch> batches;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream f(line);
+        std::string first;
+        if (!(f >> first) || first[0] == '#')
+            continue;
+        if (first == "decimals") {
+            batches.emplace_back();
+            for (int d; f >> d;)
+                batches.back().decimals.push_back(d);
+        } else {
+            Sample s{(uint32_t)std::stoul(first), {}};
+            for (long long v; f >> v;)
+                s.values.push_back(v);
+            batches.back().samples.push_back(s);
+        }
+    }
+    return batches;
+}
+
+static std::string readFile(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+int main() {
+    auto batches = readSamples("fixtures/telemetry.samples");
+    CHECK_EQ(batches.size(), 2u);
+
+    static uint8_t buf[2048];
+    TelemetryEncoder encoder(buf, sizeof(buf));
+    std::string bin, csv;
+    for (const auto& b : batches) {
+        size_t n = b.decimals.size();
+        for (const auto& s : b.samples) {
+            CHECK_EQ(s.values.size(), n);
+            CHECK(encoder.fits(b.decimals.data(), n));
+            CHECK(encoder.add(s.t, s.values.data(), b.decimals.data(), n));
+            csv += std::to_string(s.t);
+            for (size_t i = 0; i < n; ++i) {
+                char tmp[24];
+                csv += ',';
+                csv.append(tmp, formatFixed(tmp, s.values[i], b.decimals[i]));
+            }
+            csv += '\n';
+        }
+        CHECK_EQ(encoder.samples(), b.samples.size());
+        bin.append((const char*)encoder.data(), encoder.length());
+        encoder.clear();
+    }
+    CHECK(bin == readFile("fixtures/telemetry.bin"));
+    CHECK_STR(csv, readFile("fixtures/telemetry.csv"));
+
+    // a different schema needs a new batch
+    const uint8_t d1[] = {1, 0}, d2[] = {1, 1};
+    const int64_t v[] = {1, 2};
+    CHECK(encoder.add(0, v, d1, 2));
+    CHECK(!encoder.fits(d2, 2));
+    CHECK(!encoder.add(5, v, d2, 2));
+    CHECK(!encoder.fits(d1, 1));
+    CHECK(encoder.fits(d1, 2));
+
+    // full buffer
+    uint8_t small[32];
+    TelemetryEncoder tiny(small, sizeof(small));
+    size_t added = 0;
+    while (tiny.add(added, v, d1, 2))
+        ++added;
+    CHECK_EQ(added, 1u); // header 7 + one sample of at most 25 bytes
+    CHECK(tiny.length() <= sizeof(small));
+    return test_result();
+}
@@ -0,0 +1,35 @@
+#include "test.h"
+#include "text_writer.h"
+#include <climits>
+
+int main() {
+    TextBuffer<64> w;
+    CHECK_STR(w.c_str(), "");
+    w.ch('[').fixed(653, 1).ch(',').fixed(-5, 2).ch(',').num(INT64_MIN).ch(']');
+    CHECK_STR(w.c_str(), "[65.3,-0.05,-9223372036854775808]");
+    CHECK(!w.overflow());
+    w.clear();
+    w.hex(0x0A).ch(' ').hex((const uint8_t*)"\x01\xAB\xFF", 3);
+    CHECK_STR(w.c_str(), "0A 01 AB FF");
+    CHECK_EQ(w.available(), 63 - w.length());
+
+    // output that doesn't fit is cut off, the text stays terminated
+    TextBuffer<8> small;
+    small.str("0123456789");
+    CHECK_STR(small.c_str(), "0123456");
+    CHECK(small.overflow());
+    CHECK_EQ(small.available(), 0u);
+    small.clear();
+    CHECK(!small.overflow());
+    small.hex((const uint8_t*)"\x01\x02\x03\x04", 4);
+    CHECK_STR(small.c_str(), "01 02 0");
+    CHECK(small.overflow());
+
+    // over an external buffer
+    char buf[4] = {'x', 'x', 'x', 'x'};
+    TextWriter e(buf, sizeof(buf));
+    CHECK_STR(buf, "");
+    e.num(12345);
+    CHECK_STR(buf, "123");
+    return test_result();
+}
@@ -0,0 +1,83 @@
+#include "test.h"
+#include "topic_alias.h"
+#include <string>
+
+static TopicAliases aliases;
+
+// "alias" when only the alias is sent, "alias+topic" when the topic goes along, "-" without alias
+static std::string get(const char* topic) {
+    bool send_topic;
+    uint16_t alias = aliases.get(topic, send_topic);
+    if (!alias)
+        return send_topic ? "-" : "no topic without alias";
+    std::string s = std::to_string(alias);
+    if (send_topic)
+        s += "+topic";
+    return s;
+}
+
+static void testAssign() {
+    aliases.connected();
+    CHECK_STR(get("itho/a/status"), "1+topic");
+    CHECK_STR(get("itho/a/dht"), "2+topic");
+    CHECK_STR(get("itho/a/status"), "1");
+    CHECK_STR(get("itho/a/dht"), "2");
+    // a new connection: same aliases, sent with their topics again
+    aliases.connected();
+    CHECK_STR(get("itho/a/dht"), "2+topic");
+    CHECK_STR(get("itho/a/dht"), "2");
+    CHECK_STR(get("itho/a/status"), "1+topic");
+}
+
+static void testFull() {
+    for (int i = 3; i <= MQTT5_TOPIC_ALIASES; ++i) {
+        std::string alias = std::to_string(i);
+        CHECK_STR(get(alias.c_str()), alias.append("+topic"));
+    }
+    CHECK_STR(get("one too many"), "-");
+    CHECK_STR(get("one too many"), "-");
+    std::string long_topic(MQTT_MAX_TOPIC + 1, 'x');
+    CHECK_STR(get(long_topic.c_str()), "-");
+}
+
+static void testBrokerLimit() {
+    // Topic Alias Maximum 1 from the CONNACK
+    aliases.connected(1);
+    CHECK_EQ(aliases.limit(), 1);
+    CHECK_STR(get("itho/a/status"), "1+topic");
+    CHECK_STR(get("itho/a/dht"), "-");
+    CHECK_STR(get("itho/a/status"), "1");
+
+    // learned from the client refusing alias 3: 1 and 2 stay in use, 3 is sent with its topic next time
+    aliases.connected();
+    CHECK_EQ(aliases.limit(), MQTT5_TOPIC_ALIASES);
+    CHECK_STR(get("itho/a/status"), "1+topic");
+    CHECK_STR(get("itho/a/dht"), "2+topic");
+    CHECK_STR(get("3"), "3+topic");
+    aliases.rejected(3);
+    CHECK_EQ(aliases.limit(), 2);
+    CHECK_STR(get("3"), "-");
+    CHECK_STR(get("4"), "-");
+    CHECK_STR(get("itho/a/dht"), "2");
+    aliases.rejected(0);
+    aliases.rejected(MQTT5_TOPIC_ALIASES + 1);
+    CHECK_EQ(aliases.limit(), 2);
+
+    // no aliases at all (no Topic Alias Maximum in the CONNACK)
+    aliases.connected();
+    CHECK_STR(get("itho/a/status"), "1+topic");
+    aliases.rejected(1);
+    CHECK_STR(get("itho/a/status"), "-");
+
+    // the next broker may allow them again
+    aliases.connected(20);
+    CHECK_EQ(aliases.limit(), MQTT5_TOPIC_ALIASES);
+    CHECK_STR(get("3"), "3+topic");
+}
+
+int main() {
+    testAssign();
+    testFull();
+    testBrokerLimit();
+    return test_result();
+}
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""
+Decoder for the binary status telemetry published to esp-data-bin (see main/telemetry.h).
+
+Usage: itho_telemetry.py capture.bin
+    Prints the samples of a capture (esp-data-bin payloads, concatenated, e.g. `mosquitto_sub -N -t esp-data-bin > capture.bin`)
+    as CSV: uptime in s followed by the status values.
+
+As a library: decode_batch() / decode_stream() return raw integer values with their decimals,
+encode_batch() is the inverse (for round-trip checks).
+"""
+import struct
+import sys
+
+MAGIC = 0x49
+VERSION = 1
+
+
+def _varint(data, i):
+    x = shift = 0
+    while True:
+        b = data[i]
+        i += 1
+        x |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            return x, i
+
+
+def _s64(x):
+    """Wraps like the firmware's int64 arithmetic."""
+    return (x + (1 << 63)) % (1 << 64) - (1 << 63)
+
+
+def _put_varint(out, x):
+    while x >= 0x80:
+        out.append((x & 0x7F) | 0x80)
+        x >>= 7
+    out.append(x)
+
+
+def decode_batch(data, i=0):
+    """Decodes one batch at offset i. Returns (decimals, [(t, [value, ...]), ...], offset after the batch)."""
+    magic, version, n, count = struct.unpack_from("<BBBH", data, i)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError(f"not a telemetry batch at offset {i}")
+    i += 5
+    decimals = list(data[i : i + n])
+    i += n
+    t = 0
+    last = [0] * n
+    samples = []
+    for _ in range(count):
+        dt, i = _varint(data, i)
+        t += dt
+        for k in range(n):
+            z, i = _varint(data, i)
+            last[k] = _s64(last[k] + ((z >> 1) ^ -(z & 1)))
+        samples.append((t, list(last)))
+    return decimals, samples, i
+
+
+def decode_stream(data):
+    """Yields (decimals, samples) for every batch in a concatenation of batches."""
+    i = 0
+    while i < len(data):
+        decimals, samples, i = decode_batch(data, i)
+        yield decimals, samples
+
+
+def encode_batch(decimals, samples):
+    """Encodes samples [(t, [value, ...]), ...] like the firmware does."""
+    out = bytearray(struct.pack("<BBBH", MAGIC, VERSION, len(decimals), len(samples)))
+    out += bytes(decimals)
+    last_t = 0
+    last = [0] * len(decimals)
+    for t, values in samples:
+        _put_varint(out, t - last_t)
+        last_t = t
+        for k, v in enumerate(values):
+            d = _s64(v - last[k])
+            _put_varint(out, (d << 1) ^ (d >> 63))
+            last[k] = v
+    return bytes(out)
+
+
+def format_value(value, decimals):
+    """Formats a raw value like the JSON status does, e.g. (-5, 2) -> "-0.05"."""
+    if not decimals:
+        return str(value)
+    s = str(abs(value)).rjust(decimals + 1, "0")
+    return ("-" if value < 0 else "") + s[:-decimals] + "." + s[-decimals:]
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit(__doc__.strip())
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    for decimals, samples in decode_stream(data):
+        for t, values in samples:
+            print(",".join([str(t)] + [format_value(v, d) for v, d in zip(values, decimals)]))
@@ -0,0 +1,278 @@
+#!/usr/bin/env python3
+"""
+Minimal MQTT 5 broker to test the firmware's MQTT 5 mode against, in place of a local Mosquitto.
+
+Usage: mqtt5_standin.py [--port 1883] [--topic-alias-max 10]
+    Then configure the device with MQTT URI mqtt://<this host>:<port> and MQTT protocol 5.
+
+QoS 0 and 1, no retained messages, sessions or will messages. Unlike Mosquitto it is strict about topic aliases: an
+alias above the Topic Alias Maximum sent in the CONNACK is answered with DISCONNECT 0x94 (Topic Alias invalid), an
+empty topic with an alias not set on this connection with DISCONNECT 0x82 (Protocol Error).
+Every PUBLISH is logged with its alias, message expiry and correlation data, and forwarded to the subscribers with the
+topic resolved and without the alias.
+"""
+import argparse
+import asyncio
+import struct
+import sys
+
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK, PINGREQ, PINGRESP, DISCONNECT = 1, 2, 3, 4, 8, 9, 12, 13, 14
+
+PROTOCOL_ERROR = 0x82
+TOPIC_ALIAS_INVALID = 0x94
+
+# property id -> value type
+PROPERTY_TYPES = {
+    0x01: "byte", 0x02: "int4", 0x03: "str", 0x08: "str", 0x09: "bin", 0x0B: "varint", 0x11: "int4", 0x12: "str",
+    0x13: "int2", 0x15: "str", 0x16: "bin", 0x17: "byte", 0x18: "int4", 0x19: "byte", 0x1A: "str", 0x1C: "str",
+    0x1F: "str", 0x21: "int2", 0x22: "int2", 0x23: "int2", 0x24: "byte", 0x25: "byte", 0x26: "pair", 0x27: "int4",
+    0x28: "byte", 0x29: "byte", 0x2A: "byte",
+}
+MESSAGE_EXPIRY, RESPONSE_TOPIC, CORRELATION_DATA, TOPIC_ALIAS_MAXIMUM, TOPIC_ALIAS = 0x02, 0x08, 0x09, 0x22, 0x23
+
+
+class ProtocolError(Exception):
+    def __init__(self, reason, text):
+        super().__init__(text)
+        self.reason = reason
+
+
+def encode_varint(x):
+    out = bytearray()
+    while True:
+        b = x & 0x7F
+        x >>= 7
+        out.append(b | (0x80 if x else 0))
+        if not x:
+            return bytes(out)
+
+
+def decode_varint(data, i):
+    x = shift = 0
+    while True:
+        b = data[i]
+        i += 1
+        x |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            return x, i
+
+
+def encode_str(s):
+    b = s.encode() if isinstance(s, str) else s
+    return struct.pack(">H", len(b)) + b
+
+
+def decode_str(data, i):
+    (n,) = struct.unpack_from(">H", data, i)
+    return bytes(data[i + 2 : i + 2 + n]), i + 2 + n
+
+
+def encode_properties(props):
+    """props: [(id, value), ...] with str/bytes values for str/bin, ints otherwise, (key, value) for user properties."""
+    out = bytearray()
+    for pid, value in props:
+        out.append(pid)
+        kind = PROPERTY_TYPES[pid]
+        if kind == "byte":
+            out.append(value)
+        elif kind == "int2":
+            out += struct.pack(">H", value)
+        elif kind == "int4":
+            out += struct.pack(">I", value)
+        elif kind == "varint":
+            out += encode_varint(value)
+        elif kind == "pair":
+            out += encode_str(value[0]) + encode_str(value[1])
+        else:
+            out += encode_str(value)
+    return encode_varint(len(out)) + bytes(out)
+
+
+def decode_properties(data, i):
+    n, i = decode_varint(data, i)
+    end = i + n
+    props = []
+    while i < end:
+        pid = data[i]
+        i += 1
+        kind = PROPERTY_TYPES.get(pid)
+        if kind == "byte":
+            value = data[i]
+            i += 1
+        elif kind == "int2":
+            (value,) = struct.unpack_from(">H", data, i)
+            i += 2
+        elif kind == "int4":
+            (value,) = struct.unpack_from(">I", data, i)
+            i += 4
+        elif kind == "varint":
+            value, i = decode_varint(data, i)
+        elif kind == "pair":
+            key, i = decode_str(data, i)
+            value, i = decode_str(data, i)
+            value = (key, value)
+        elif kind in ("str", "bin"):
+            value, i = decode_str(data, i)
+        else:
+            raise ProtocolError(PROTOCOL_ERROR, f"unknown property 0x{pid:02x}")
+        props.append((pid, value))
+    return props, end
+
+
+def packet(kind, flags, body):
+    return bytes([kind << 4 | flags]) + encode_varint(len(body)) + body
+
+
+def publish_packet(topic, payload, props=(), qos=0, packet_id=0):
+    body = encode_str(topic) + (struct.pack(">H", packet_id) if qos else b"") + encode_properties(props) + payload
+    return packet(PUBLISH, qos << 1, body)
+
+
+def decode_publish(flags, body):
+    """Returns (topic, qos, packet id, properties, payload)."""
+    qos = (flags >> 1) & 3
+    topic, i = decode_str(body, 0)
+    packet_id = 0
+    if qos:
+        (packet_id,) = struct.unpack_from(">H", body, i)
+        i += 2
+    props, i = decode_properties(body, i)
+    return topic.decode(), qos, packet_id, props, bytes(body[i:])
+
+
+async def read_packet(reader):
+    """Returns (type, flags, body) or None at EOF."""
+    try:
+        header = await reader.readexactly(1)
+        length = shift = 0
+        while True:
+            b = (await reader.readexactly(1))[0]
+            length |= (b & 0x7F) << shift
+            shift += 7
+            if b < 0x80:
+                break
+        body = await reader.readexactly(length)
+    except asyncio.IncompleteReadError:
+        return None
+    return header[0] >> 4, header[0] & 0x0F, body
+
+
+def topic_matches(topic_filter, topic):
+    f, t = topic_filter.split("/"), topic.split("/")
+    for i, level in enumerate(f):
+        if level == "#":
+            return True
+        if i >= len(t) or (level != "+" and level != t[i]):
+            return False
+    return len(f) == len(t)
+
+
+class Broker:
+    def __init__(self, topic_alias_max=10, log=print):
+        self.topic_alias_max = topic_alias_max
+        self.log = log
+        self.subscriptions = {}  # writer -> [topic filter, ...]
+
+    async def start(self, host="0.0.0.0", port=1883):
+        self.server = await asyncio.start_server(self.client, host, port)
+        return self.server.sockets[0].getsockname()[1]
+
+    def close(self):
+        self.server.close()
+
+    async def client(self, reader, writer):
+        client_id = "?"
+        aliases = {}  # alias -> topic, only valid on this connection
+        try:
+            first = await read_packet(reader)
+            if not first or first[0] != CONNECT:
+                return
+            body = first[2]
+            _, i = decode_str(body, 0)
+            level = body[i]
+            if level != 5:
+                self.log(f"refusing MQTT protocol level {level}")
+                writer.write(packet(CONNACK, 0, bytes([0, 1])))  # 3.1.1: unacceptable protocol version
+                return
+            _, i = decode_properties(body, i + 4)
+            client_id = decode_str(body, i)[0].decode() or "?"
+            connack_props = [(TOPIC_ALIAS_MAXIMUM, self.topic_alias_max)] if self.topic_alias_max else []
+            writer.write(packet(CONNACK, 0, bytes([0, 0]) + encode_properties(connack_props)))
+            self.log(f"{client_id} connected")
+            self.subscriptions[writer] = []
+            while (p := await read_packet(reader)) is not None:
+                kind, flags, body = p
+                if kind == PUBLISH:
+                    self.publish(client_id, aliases, writer, flags, body)
+                elif kind == SUBSCRIBE:
+                    packet_id = body[:2]
+                    _, i = decode_properties(body, 2)
+                    codes = bytearray()
+                    while i < len(body):
+                        topic_filter, i = decode_str(body, i)
+                        self.subscriptions[writer].append(topic_filter.decode())
+                        i += 1
+                        codes.append(0)  # granted QoS 0
+                    writer.write(packet(SUBACK, 0, packet_id + encode_properties([]) + bytes(codes)))
+                elif kind == PINGREQ:
+                    writer.write(packet(PINGRESP, 0, b""))
+                elif kind == DISCONNECT:
+                    break
+            self.log(f"{client_id} disconnected")
+        except ProtocolError as e:
+            self.log(f"{client_id} disconnected: {e}")
+            writer.write(packet(DISCONNECT, 0, bytes([e.reason]) + encode_properties([(0x1F, str(e))])))
+        finally:
+            self.subscriptions.pop(writer, None)
+            await writer.drain()
+            writer.close()
+
+    def publish(self, client_id, aliases, writer, flags, body):
+        topic, qos, packet_id, props, payload = decode_publish(flags, body)
+        alias = next((v for k, v in props if k == TOPIC_ALIAS), None)
+        if alias is not None:
+            if alias == 0 or alias > self.topic_alias_max:
+                raise ProtocolError(TOPIC_ALIAS_INVALID, f"topic alias {alias} above the maximum {self.topic_alias_max}")
+            if topic:
+                aliases[alias] = topic
+            elif alias in aliases:
+                topic = aliases[alias]
+            else:
+                raise ProtocolError(PROTOCOL_ERROR, f"topic alias {alias} was not set on this connection")
+        elif not topic:
+            raise ProtocolError(PROTOCOL_ERROR, "empty topic without topic alias")
+        expiry = next((v for k, v in props if k == MESSAGE_EXPIRY), None)
+        correlation = next((v for k, v in props if k == CORRELATION_DATA), None)
+        self.log(
+            f"{client_id} {topic} {len(payload)} bytes"
+            + (f" alias={alias}" if alias is not None else "")
+            + (f" expiry={expiry}" if expiry is not None else "")
+            + (f" correlation={correlation.hex()}" if correlation is not None else "")
+        )
+        if qos == 1:
+            writer.write(packet(PUBACK, 0, struct.pack(">H", packet_id)))
+        elif qos:
+            raise ProtocolError(PROTOCOL_ERROR, "QoS 2 is not supported")
+        forward = publish_packet(topic, payload, [(k, v) for k, v in props if k != TOPIC_ALIAS])
+        for subscriber, filters in self.subscriptions.items():
+            if any(topic_matches(f, topic) for f in filters):
+                subscriber.write(forward)
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--topic-alias-max", type=int, default=10, help="Topic Alias Maximum sent in the CONNACK")
+    args = parser.parse_args()
+    broker = Broker(args.topic_alias_max, lambda s: print(s, flush=True))
+    port = await broker.start(port=args.port)
+    print(f"listening on port {port}, Topic Alias Maximum {args.topic_alias_max}", flush=True)
+    await broker.server.serve_forever()
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        sys.exit(0)
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""
+Converts a binary I2C sniffer capture (the esp-data-sniff-bin MQTT payloads, concatenated)
+to a pcap file with the Linux I2C link type, for viewing in Wireshark.
+
+Usage: sniff2pcap.py capture.bin capture.pcap
+
+Record format: see I2C_SNIFFER_RECORD_MAGIC in main/i2c_sniffer.h
+"""
+import struct
+import sys
+
+RECORD_MAGIC = 0xA5
+RECORD_HEADER = 12
+LINKTYPE_I2C_LINUX = 209
+I2C_FLAG_RD = 0x00000001
+
+REC_BAD_CHECKSUM = 1
+REC_TRUNCATED = 2
+REC_NACK = 4
+
+
+def read_records(data):
+    """Yields (sec, usec, address byte, flags, ack bitmap, payload), skipping garbage between records."""
+    i = 0
+    while i + RECORD_HEADER <= len(data):
+        if data[i] != RECORD_MAGIC or data[i + 3] & ~(REC_BAD_CHECKSUM | REC_TRUNCATED | REC_NACK):
+            i += 1
+            continue
+        n, addr, flags, sec, usec = struct.unpack_from("<BBBII", data, i + 1)
+        acklen = (n + 8) // 8
+        end = i + RECORD_HEADER + acklen + n
+        if usec >= 1000000 or end > len(data):
+            i += 1
+            continue
+        ack = data[i + RECORD_HEADER : i + RECORD_HEADER + acklen]
+        payload = data[i + RECORD_HEADER + acklen : end]
+        yield sec, usec, addr, flags, ack, payload
+        i = end
+
+
+def convert(src, dst):
+    with open(src, "rb") as f:
+        data = f.read()
+    count = bad = 0
+    with open(dst, "wb") as out:
+        out.write(struct.pack("<IHHiIII", 0xA1B2C3D4, 2, 4, 0, 0, 65535, LINKTYPE_I2C_LINUX))
+        for sec, usec, addr, flags, ack, payload in read_records(data):
+            # pseudo-header: bus number (u8), flags (u32, big endian)
+            pkt = struct.pack(">BI", 0, I2C_FLAG_RD if addr & 1 else 0) + bytes([addr]) + payload
+            out.write(struct.pack("<IIII", sec, usec, len(pkt), len(pkt)))
+            out.write(pkt)
+            count += 1
+            if flags:
+                bad += 1
+    print(f"{count} frames written, {bad} with errors", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit(__doc__.strip())
+    convert(sys.argv[1], sys.argv[2])